@@ -5,10 +5,18 @@
 //#define WIB_PFR_ENABLED
 //#define WIB_CISTA_ENABLED
 #define WIB_CEREAL_ENABLED
+#define WIB_PARALLEL_ENABLED
+#define WIB_STATS_ENABLED
 #include "../wib/wib.hpp"
 
 #include <iostream>
 #include <map>
+#include <set>
+#include <list>
+#include <forward_list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <type_traits>
 #include <mutex>
 #include <array>
@@ -16,6 +24,15 @@
 #include <string>
 #include <cstddef>
 #include <any>
+#include <tuple>
+#include <execution>
+#include <thread>
+#include <random>
+#include <sstream>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <cstdlib>
 
 
 
@@ -24,6 +41,21 @@ using byte_t = char;
 static_assert(sizeof(byte_t) == 1);
 using bytevec_t = std::vector<byte_t>;
 
+// Same layout as T, but forces wib to visit every element
+template <typename T>
+struct iterated_t {
+	auto weight_in_bytes() const -> size_t { return 0; }
+	auto operator<(const iterated_t& other) const -> bool { return value < other.value; }
+	auto operator==(const iterated_t& other) const -> bool { return value == other.value; }
+	T value{};
+};
+struct iterated_hash_t {
+	template <typename T>
+	auto operator()(const iterated_t<T>& v) const noexcept -> size_t { return std::hash<T>{}(v.value); }
+};
+static_assert(sizeof(iterated_t<int>) == sizeof(int));
+static_assert(!wib::never_allocates_v<iterated_t<int>>);
+
 }
 
 
@@ -160,6 +192,66 @@ TEST_CASE("continous memory containers") {
 
 
 
+TEST_CASE("never_allocates_v") {
+	enum class enum_t { A, B };
+	static_assert(wib::never_allocates_v<int>);
+	static_assert(wib::never_allocates_v<const double>);
+	static_assert(wib::never_allocates_v<enum_t>);
+	static_assert(wib::never_allocates_v<std::array<int, 45>>);
+	static_assert(wib::never_allocates_v<std::array<std::array<float, 4>, 4>>);
+	static_assert(wib::never_allocates_v<int[16]>);
+	static_assert(wib::never_allocates_v<std::pair<int, double>>);
+	static_assert(wib::never_allocates_v<std::tuple<int, std::optional<float>>>);
+	static_assert(wib::never_allocates_v<std::variant<int, double>>);
+	static_assert(wib::never_allocates_v<std::string_view>);
+	static_assert(!wib::never_allocates_v<bytevec_t>);
+	static_assert(!wib::never_allocates_v<std::string>);
+	static_assert(!wib::never_allocates_v<std::array<bytevec_t, 2>>);
+	static_assert(!wib::never_allocates_v<std::unique_ptr<int>>);
+	static_assert(!wib::never_allocates_v<int*>);
+	static_assert(!wib::never_allocates_v<std::any>);
+	static_assert(!wib::never_allocates_v<std::variant<int, std::string>>);
+	{
+		class tuple_access_t {
+		public:
+			auto as_tuple() const { return std::tie(a, b); }
+		private:
+			int a{};
+			std::array<double, 8> b{};
+		};
+		static_assert(wib::never_allocates_v<tuple_access_t>);
+		struct custom_t {
+			auto weight_in_bytes() const -> size_t { return 0; }
+			double d{};
+		};
+		static_assert(!wib::never_allocates_v<custom_t>);
+	}
+	{
+		struct flat_t {
+			int a{};
+			std::array<double, 4> b{};
+		};
+		struct nested_t {
+			flat_t f{};
+			std::string s{};
+		};
+#if defined(WIB_PFR_ENABLED) || defined(WIB_CISTA_ENABLED)
+		static_assert(wib::never_allocates_v<flat_t>);
+#else
+		static_assert(!wib::never_allocates_v<flat_t>);
+#endif
+		static_assert(!wib::never_allocates_v<nested_t>);
+	}
+	// Heap-free elements of a vector are not visited, but the allocation is counted
+	{
+		using array_t = std::array<int, 45>;
+		auto vec = std::vector<array_t>(1000);
+		REQUIRE(wib::unknown_types(vec).size() == 0);
+		REQUIRE(wib::weight_in_bytes(vec) == vec.capacity() * sizeof(array_t));
+	}
+};
+
+
 TEST_CASE("std::vector<bool>") {
 	auto v = std::vector<bool>{};
 	REQUIRE(wib::weight_in_bytes(v) == 0);
@@ -210,7 +302,7 @@ TEST_CASE("std::shared_ptr") {
 	auto sptr = std::make_shared<value_t>();
 	REQUIRE(
 		wib::weight_in_bytes(sptr) ==
-		sizeof(value_t)
+		wib::make_shared_bytes_v<value_t>
 	);
 	// All point to the same value
 	auto vec = std::vector<sptr_t>{};
@@ -218,7 +310,7 @@ TEST_CASE("std::shared_ptr") {
 	std::fill(vec.begin(), vec.end(), sptr);
 	REQUIRE(
 		wib::weight_in_bytes(vec) ==
-		sizeof(value_t) +
+		wib::make_shared_bytes_v<value_t> +
 		vec.capacity() * sizeof(sptr_t)
 	);
 
@@ -227,11 +319,560 @@ TEST_CASE("std::shared_ptr") {
 	arr.fill(sptr);
 	REQUIRE(
 		wib::weight_in_bytes(arr) ==
-		sizeof(value_t)
+		wib::make_shared_bytes_v<value_t>
 	);
 };
 
 
+namespace {
+struct chain_node_t {
+	auto as_tuple() const { return std::tie(payload, next); }
+	bytevec_t payload{};
+	std::shared_ptr<chain_node_t> next{};
+};
+auto make_chain(size_t length) -> std::shared_ptr<chain_node_t> {
+	auto head = std::shared_ptr<chain_node_t>{};
+	for (size_t i = 0; i < length; ++i) {
+		auto node = std::make_shared<chain_node_t>();
+		node->next = std::move(head);
+		head = std::move(node);
+	}
+	return head;
+}
+// Unlink iteratively as the recursive destructor would overflow the stack
+auto destroy_chain(std::shared_ptr<chain_node_t>& head) -> void {
+	while (head != nullptr) {
+		head = std::move(head->next);
+	}
+}
+
+// Tree holding its children by value
+struct nested_node_t {
+	auto as_tuple() const { return std::tie(children); }
+	std::vector<nested_node_t> children{};
+};
+auto make_nested(size_t depth) -> nested_node_t {
+	auto root = nested_node_t{};
+	auto* node = &root;
+	for (size_t i = 0; i < depth; ++i) {
+		node->children.resize(1);
+		node = &node->children.front();
+	}
+	return root;
+}
+auto destroy_nested(nested_node_t& root) -> void {
+	while (!root.children.empty()) {
+		auto children = std::move(root.children.front().children);
+		root.children = std::move(children);
+	}
+}
+}
+
+TEST_CASE("iterative traversal") {
+	auto iterative = wib::options_t{};
+	iterative.traversal = wib::etraversal::Iterative;
+	// Same result as the recursive traversal
+	{
+		auto head = make_chain(100);
+		head->next->payload.resize(1000);
+		const auto report = wib::measure(head, iterative);
+		REQUIRE(report.bytes == wib::weight_in_bytes(head));
+		REQUIRE(report.bytes == 100 * wib::make_shared_bytes_v<chain_node_t> + 1000);
+		REQUIRE(!report.depth_truncated);
+		destroy_chain(head);
+	}
+	// Chains longer than the thread stack allows for
+	{
+		constexpr auto length = size_t{ 2'000'000 };
+		auto head = make_chain(length);
+		REQUIRE(wib::weight_in_bytes(head, iterative) == length * wib::make_shared_bytes_v<chain_node_t>);
+		destroy_chain(head);
+	}
+	// Container nesting deeper than the thread stack allows for
+	{
+		constexpr auto depth = size_t{ 2'000'000 };
+		auto root = make_nested(depth);
+		REQUIRE(wib::weight_in_bytes(root, iterative) == depth * sizeof(nested_node_t));
+		destroy_nested(root);
+	}
+	// Elements are measured in order, shared pointees are attributed to the
+	// first element holding them as with the recursive traversal
+	{
+		auto shared = std::make_shared<bytevec_t>(100);
+		auto nested = std::list<std::vector<std::shared_ptr<bytevec_t>>>{
+			{ nullptr, std::make_shared<bytevec_t>(10) },
+			{ shared },
+			{ std::make_shared<bytevec_t>(20), shared }
+		};
+		// Blocks of equal size are listed in the order they are visited
+		auto blocks_f = [&nested](const wib::options_t& options) {
+			auto blocks = std::vector<std::pair<size_t, std::string>>{};
+			for (const auto& block : wib::top_n(nested, 100, options)) {
+				blocks.emplace_back(block.bytes, block.path);
+			}
+			std::sort(blocks.begin(), blocks.end());
+			return blocks;
+		};
+		REQUIRE(blocks_f(iterative) == blocks_f(wib::options_t{}));
+		REQUIRE(wib::measure(nested, iterative).heap_blocks == wib::measure(nested).heap_blocks);
+	}
+	// Ranges of an as_tuple() returned by value are measured before the tuple
+	// is destroyed
+	{
+		struct by_value_t {
+			auto as_tuple() const { return std::make_tuple(names, sibling); }
+			std::vector<std::string> names{};
+			std::shared_ptr<std::vector<std::string>> sibling{};
+		};
+		auto value = std::vector<by_value_t>(2);
+		for (auto& element : value) {
+			element.names.assign(10, std::string(100, 'a'));
+			element.sibling = std::make_shared<std::vector<std::string>>(3, std::string(200, 'b'));
+		}
+		value.back().names.back().resize(1000);
+		REQUIRE(wib::weight_in_bytes(value, iterative) == wib::weight_in_bytes(value));
+		REQUIRE(wib::breakdown(value, iterative).inclusive_bytes == wib::breakdown(value).inclusive_bytes);
+		REQUIRE(wib::measure(value, iterative).heap_blocks == wib::measure(value).heap_blocks);
+	}
+}
+
+TEST_CASE("iterative traversal benchmark", "[.benchmark]") {
+	using steady_clock_t = std::chrono::steady_clock;
+	using ms_t = std::chrono::duration<double, std::milli>;
+	auto recursive = wib::options_t{};
+	auto iterative = wib::options_t{};
+	iterative.traversal = wib::etraversal::Iterative;
+	auto run = [](const char* name, const auto& value, const wib::options_t& options) {
+		const auto start = steady_clock_t::now();
+		const auto bytes = wib::weight_in_bytes(value, options);
+		const auto ms = ms_t{ steady_clock_t::now() - start }.count();
+		std::cout << name << ": " << ms << " ms (" << bytes << " bytes)" << std::endl;
+		return bytes;
+	};
+	// Shallow and wide, deep pointer chains and deep container nesting, each
+	// shallow enough for the recursive traversal
+	auto strings = std::vector<std::string>(5'000'000, std::string(32, 'a'));
+	REQUIRE(run("wide recursive", strings, recursive) == run("wide iterative", strings, iterative));
+	auto head = make_chain(10'000);
+	REQUIRE(run("chain recursive", head, recursive) == run("chain iterative", head, iterative));
+	destroy_chain(head);
+	auto root = make_nested(2'000);
+	REQUIRE(run("nested recursive", root, recursive) == run("nested iterative", root, iterative));
+	destroy_nested(root);
+}
+
+TEST_CASE("max_depth") {
+	auto head = make_chain(100);
+	for (auto traversal : { wib::etraversal::Recursive, wib::etraversal::Iterative }) {
+		auto options = wib::options_t{};
+		options.traversal = traversal;
+		options.max_depth = 0;
+		{
+			const auto report = wib::measure(head, options);
+			REQUIRE(report.bytes == wib::make_shared_bytes_v<chain_node_t>);
+			REQUIRE(report.depth_truncated);
+			// Truncated nodes do not use up the node budget
+			REQUIRE(report.nodes_visited == 1);
+			auto budgeted = options;
+			budgeted.node_budget = 1;
+			REQUIRE(!wib::measure(head, budgeted).node_budget_exhausted);
+		}
+		options.max_depth = 30;
+		{
+			const auto report = wib::measure(head, options);
+			REQUIRE(report.bytes > wib::make_shared_bytes_v<chain_node_t>);
+			REQUIRE(report.bytes < 100 * wib::make_shared_bytes_v<chain_node_t>);
+			REQUIRE(report.depth_truncated);
+		}
+		options.max_depth = 1000;
+		{
+			const auto report = wib::measure(head, options);
+			REQUIRE(report.bytes == 100 * wib::make_shared_bytes_v<chain_node_t>);
+			REQUIRE(!report.depth_truncated);
+		}
+	}
+	destroy_chain(head);
+}
+
+
+TEST_CASE("address set") {
+	auto set = wib::detail::address_set_t{};
+	auto values = std::vector<int>(10000);
+	auto inserted = size_t{ 0 };
+	for (const auto& v : values) {
+		inserted += set.insert(reinterpret_cast<wib::detail::byteptr_t>(&v)) ? 1 : 0;
+	}
+	REQUIRE(inserted == values.size());
+	REQUIRE(set.size() == values.size());
+	auto found = size_t{ 0 };
+	for (const auto& v : values) {
+		found += set.contains(reinterpret_cast<wib::detail::byteptr_t>(&v)) ? 1 : 0;
+		found += set.insert(reinterpret_cast<wib::detail::byteptr_t>(&v)) ? 0 : 1;
+	}
+	REQUIRE(found == values.size() * 2);
+	REQUIRE(set.size() == values.size());
+	// Capacity is kept when cleared
+	const auto capacity = set.capacity();
+	set.clear();
+	REQUIRE(set.size() == 0);
+	REQUIRE(set.capacity() == capacity);
+	REQUIRE(!set.contains(reinterpret_cast<wib::detail::byteptr_t>(&values[0])));
+}
+
+TEST_CASE("address set benchmark", "[.benchmark]") {
+	using steady_clock_t = std::chrono::steady_clock;
+	using ms_t = std::chrono::duration<double, std::milli>;
+	using byteptr_t = wib::detail::byteptr_t;
+	// Simulated 16 byte aligned heap addresses, every address is inserted twice
+	auto address_of = [](size_t i) { return reinterpret_cast<byteptr_t>(0x10000 + i * 16); };
+	for (const auto count : { size_t{ 1'000 }, size_t{ 1'000'000 }, size_t{ 50'000'000 } }) {
+		auto flat_hits = size_t{ 0 };
+		const auto flat_start = steady_clock_t::now();
+		{
+			auto set = wib::detail::address_set_t{};
+			for (size_t i = 0; i < count * 2; ++i) {
+				flat_hits += set.insert(address_of(i % count)) ? 0 : 1;
+			}
+		}
+		const auto flat_ms = ms_t{ steady_clock_t::now() - flat_start }.count();
+		auto std_hits = size_t{ 0 };
+		const auto std_start = steady_clock_t::now();
+		{
+			auto set = std::unordered_set<byteptr_t>{};
+			for (size_t i = 0; i < count * 2; ++i) {
+				const auto address = address_of(i % count);
+				if (set.count(address) > 0) {
+					++std_hits;
+					continue;
+				}
+				set.insert(address);
+			}
+		}
+		const auto std_ms = ms_t{ steady_clock_t::now() - std_start }.count();
+		REQUIRE(flat_hits == count);
+		REQUIRE(std_hits == count);
+		std::cout
+			<< count << " pointers: "
+			<< "address_set_t " << flat_ms << " ms, "
+			<< "std::unordered_set " << std_ms << " ms" << std::endl;
+	}
+}
+
+
+TEST_CASE("measurement_context_t") {
+	using value_t = std::array<byte_t, 128>;
+	auto shared = std::make_shared<value_t>();
+	auto vec = std::vector<std::shared_ptr<value_t>>(100, shared);
+	for (auto& sptr : vec) {
+		if (&sptr != &vec.front()) {
+			sptr = std::make_shared<value_t>();
+		}
+	}
+	const auto expected = wib::weight_in_bytes(vec);
+	auto context = wib::measurement_context_t{};
+	REQUIRE(wib::weight_in_bytes(context, vec) == expected);
+	const auto capacity = context.handled_addresses.capacity();
+	REQUIRE(capacity > 0);
+	// Every measurement starts from scratch but keeps the capacity
+	for (int i = 0; i < 10; ++i) {
+		REQUIRE(wib::weight_in_bytes(context, vec) == expected);
+		REQUIRE(context.handled_addresses.capacity() == capacity);
+	}
+	REQUIRE(wib::measure(context, vec).bytes == expected);
+	REQUIRE(wib::unknown_types(context, std::mutex{}).size() == 1);
+	REQUIRE(wib::unknown_types(context, std::chrono::steady_clock::now()).size() == 1);
+	REQUIRE(wib::unknown_types(context, vec).empty());
+	// The unknown types are handed over to the report
+	const auto any = std::any{ std::chrono::steady_clock::now() };
+	context.reset();
+	REQUIRE(wib::measure(context, any).unknown_types.size() == 1);
+	REQUIRE(context.unknown_types.empty());
+}
+
+
+TEST_CASE("measure") {
+	struct str_t {
+		auto as_tuple() const { return std::tie(v, m, sptr, a, any); }
+		bytevec_t v{};
+		std::map<int, double> m{};
+		std::shared_ptr<bytevec_t> sptr{};
+		std::vector<std::shared_ptr<bytevec_t>> a{};
+		std::any any{};
+	};
+	auto s = str_t{};
+	REQUIRE(wib::measure(s).heap_blocks == 0);
+	s.v.resize(100);
+	s.m = { {1, 1.0}, {2, 2.0}, {3, 3.0} };
+	s.sptr = std::make_shared<bytevec_t>(200);
+	s.a = { s.sptr, s.sptr };
+	s.any = std::chrono::steady_clock::now();
+	const auto report = wib::measure(s);
+	REQUIRE(report.bytes == wib::weight_in_bytes(s));
+	REQUIRE(report.unknown_types == wib::unknown_types(s));
+	REQUIRE(report.unknown_types.size() == 1);
+	REQUIRE(!report.depth_truncated);
+	REQUIRE(
+		report.heap_blocks ==
+		1 + // v
+		3 + // m
+		2 + // sptr pointee and its buffer
+		1 // a
+	);
+}
+
+
+TEST_CASE("parallel weight_in_bytes") {
+	struct document_t {
+		auto as_tuple() const { return std::tie(body, shared, any); }
+		bytevec_t body{};
+		std::shared_ptr<bytevec_t> shared{};
+		std::any any{};
+	};
+	auto shared = std::make_shared<bytevec_t>(4096);
+	auto documents = std::vector<document_t>(1000);
+	for (size_t i = 0; i < documents.size(); ++i) {
+		documents[i].body.resize(i);
+		// Every worker sees the same shared pointee
+		documents[i].shared = i % 2 == 0 ? shared : std::make_shared<bytevec_t>(16);
+	}
+	documents[500].any = std::chrono::steady_clock::now();
+	const auto serial = wib::measure(documents);
+	for (const auto threads : { size_t{ 1 }, size_t{ 3 }, size_t{ 8 }, size_t{ 2000 } }) {
+		auto options = wib::options_t{};
+		options.max_threads = threads;
+		options.min_elements_per_thread = 1;
+		const auto parallel = wib::measure(std::execution::par, documents, options);
+		REQUIRE(parallel.bytes == serial.bytes);
+		REQUIRE(parallel.heap_blocks == serial.heap_blocks);
+		REQUIRE(parallel.unknown_types == serial.unknown_types);
+		options.traversal = wib::etraversal::Iterative;
+		REQUIRE(wib::weight_in_bytes(std::execution::par, documents, options) == serial.bytes);
+	}
+	// Nested ranges
+	{
+		auto options = wib::options_t{};
+		options.max_threads = 4;
+		options.min_elements_per_thread = 1;
+		const auto nested = std::tuple<int, std::vector<document_t>>{ 0, documents };
+		REQUIRE(wib::weight_in_bytes(std::execution::par, nested, options) == wib::weight_in_bytes(nested));
+	}
+	REQUIRE(wib::weight_in_bytes(std::execution::seq, documents) == serial.bytes);
+}
+
+TEST_CASE("parallel weight_in_bytes grain size") {
+	// Records the threads measuring it
+	struct probe_t {
+		auto weight_in_bytes() const -> size_t {
+			const auto lock = std::lock_guard<std::mutex>{ *mutex };
+			threads->insert(std::this_thread::get_id());
+			return 0;
+		}
+		std::mutex* mutex{};
+		std::set<std::thread::id>* threads{};
+	};
+	auto mutex = std::mutex{};
+	auto threads = std::set<std::thread::id>{};
+	const auto probes = std::vector<std::vector<probe_t>>(1000, std::vector<probe_t>(10, probe_t{ &mutex, &threads }));
+	auto options = wib::options_t{};
+	options.max_threads = 4;
+	// Too few elements per thread, everything is measured by the calling thread
+	REQUIRE(wib::weight_in_bytes(std::execution::par, probes, options) == wib::weight_in_bytes(probes));
+	REQUIRE(threads == std::set<std::thread::id>{ std::this_thread::get_id() });
+	options.min_elements_per_thread = 100;
+	REQUIRE(wib::weight_in_bytes(std::execution::par, probes, options) == wib::weight_in_bytes(probes));
+	REQUIRE(threads.size() == 4);
+	// Budgets are honored when the calling thread measures a range itself
+	auto strings = std::vector<std::string>(100, std::string(100, 'a'));
+	options = wib::options_t{};
+	options.max_threads = 4;
+	options.byte_limit = 1000;
+	const auto serial = wib::measure(strings, options);
+	const auto parallel = wib::measure(std::execution::par, strings, options);
+	REQUIRE(parallel.limit_exceeded);
+	REQUIRE(parallel.bytes == serial.bytes);
+	REQUIRE(parallel.nodes_visited == serial.nodes_visited);
+	options.byte_limit = std::numeric_limits<size_t>::max();
+	options.node_budget = 10;
+	REQUIRE(wib::measure(std::execution::par, strings, options).node_budget_exhausted);
+	// Workers of a split range share the budgets, each may overshoot the byte
+	// limit by the blocks it counts while another one halts
+	constexpr auto thread_count = size_t{ 8 };
+	const auto buffers = std::vector<bytevec_t>(10'000, bytevec_t(100));
+	const auto buffer_bytes = buffers.capacity() * sizeof(bytevec_t);
+	options = wib::options_t{};
+	options.max_threads = thread_count;
+	options.min_elements_per_thread = 1;
+	options.byte_limit = buffer_bytes + 1000;
+	const auto limited = wib::measure(std::execution::par, buffers, options);
+	REQUIRE(limited.limit_exceeded);
+	REQUIRE(limited.bytes > options.byte_limit);
+	REQUIRE(limited.bytes <= options.byte_limit + thread_count * 100);
+	options.byte_limit = std::numeric_limits<size_t>::max();
+	options.node_budget = 101;
+	const auto budgeted = wib::measure(std::execution::par, buffers, options);
+	REQUIRE(budgeted.node_budget_exhausted);
+	REQUIRE(budgeted.nodes_visited == 101);
+}
+
+TEST_CASE("parallel weight_in_bytes benchmark", "[.benchmark]") {
+	using steady_clock_t = std::chrono::steady_clock;
+	using ms_t = std::chrono::duration<double, std::milli>;
+	auto strings = std::vector<std::string>(10'000'000);
+	for (size_t i = 0; i < strings.size(); i += 2) {
+		strings[i].resize(32);
+	}
+	const auto max_threads = std::max(size_t{ 1 }, size_t{ std::thread::hardware_concurrency() });
+	const auto expected = wib::weight_in_bytes(strings);
+	for (auto threads = size_t{ 1 }; threads <= max_threads; threads *= 2) {
+		auto options = wib::options_t{};
+		options.max_threads = threads;
+		const auto start = steady_clock_t::now();
+		const auto bytes = wib::weight_in_bytes(std::execution::par, strings, options);
+		const auto ms = ms_t{ steady_clock_t::now() - start }.count();
+		REQUIRE(bytes == expected);
+		std::cout << threads << " threads: " << ms << " ms" << std::endl;
+	}
+}
+
+
+TEST_CASE("estimate_weight") {
+	auto strings = std::vector<std::string>(100'000);
+	auto lengths = std::mt19937{ 42 };
+	for (auto& str : strings) {
+		str.resize(std::uniform_int_distribution<size_t>{ 0, 200 }(lengths));
+	}
+	const auto exact = static_cast<double>(wib::weight_in_bytes(strings));
+	for (const auto method : { wib::esampling::Random, wib::esampling::Stratified }) {
+		auto sample_options = wib::sample_options_t{};
+		sample_options.method = method;
+		sample_options.sample_size = 2000;
+		const auto estimate = wib::estimate_weight(strings, sample_options);
+		REQUIRE(estimate.standard_error > 0.0);
+		REQUIRE(estimate.lower_bound < estimate.bytes);
+		REQUIRE(estimate.upper_bound > estimate.bytes);
+		REQUIRE(estimate.lower_bound <= exact);
+		REQUIRE(estimate.upper_bound >= exact);
+		REQUIRE(std::abs(estimate.bytes - exact) < exact * 0.05);
+	}
+	// Nested ranges and ranges without random access
+	{
+		auto nested = std::list<std::vector<std::string>>(300, std::vector<std::string>(300));
+		for (auto& inner : nested) {
+			for (auto& str : inner) {
+				str.resize(std::uniform_int_distribution<size_t>{ 0, 100 }(lengths));
+			}
+		}
+		const auto exact_nested = static_cast<double>(wib::weight_in_bytes(nested));
+		auto sample_options = wib::sample_options_t{};
+		sample_options.sample_size = 100;
+		sample_options.confidence = 0.999;
+		const auto estimate = wib::estimate_weight(nested, sample_options);
+		REQUIRE(estimate.lower_bound <= exact_nested);
+		REQUIRE(estimate.upper_bound >= exact_nested);
+	}
+	// Long ranges without random access are sampled from a prefix
+	{
+		auto list = std::list<std::string>{};
+		for (int i = 0; i < 100'000; ++i) {
+			list.emplace_back(std::uniform_int_distribution<size_t>{ 0, 200 }(lengths), ' ');
+		}
+		const auto exact_list = static_cast<double>(wib::weight_in_bytes(list));
+		auto sample_options = wib::sample_options_t{};
+		sample_options.sample_size = 500;
+		const auto estimate = wib::estimate_weight(list, sample_options);
+		REQUIRE(estimate.is_prefix_sampled);
+		REQUIRE(std::abs(estimate.bytes - exact_list) < exact_list * 0.1);
+		sample_options.prefix_factor = 1000;
+		REQUIRE(!wib::estimate_weight(list, sample_options).is_prefix_sampled);
+		REQUIRE(!wib::estimate_weight(strings, sample_options).is_prefix_sampled);
+		// The prefix saturates at the element count instead of wrapping around
+		sample_options.prefix_factor = std::numeric_limits<size_t>::max() / 4 + 1;
+		REQUIRE(!wib::estimate_weight(list, sample_options).is_prefix_sampled);
+	}
+	// Ranges not larger than the sample size are measured exactly
+	{
+		auto small = std::vector<std::string>(10, std::string(100, ' '));
+		const auto estimate = wib::estimate_weight(small);
+		REQUIRE(estimate.bytes == static_cast<double>(wib::weight_in_bytes(small)));
+		REQUIRE(estimate.standard_error == 0.0);
+	}
+}
+
+
+namespace {
+struct visit_counted_t {
+	static inline size_t visits = 0;
+	auto weight_in_bytes() const -> size_t {
+		++visits;
+		return 100;
+	}
+};
+}
+
+TEST_CASE("exceeds and weight_at_most") {
+	auto v = std::vector<visit_counted_t>(1000);
+	const auto weight = v.capacity() * sizeof(visit_counted_t) + 1000 * 100;
+	REQUIRE(wib::weight_in_bytes(v) == weight);
+	REQUIRE(!wib::exceeds(v, weight));
+	REQUIRE(wib::exceeds(v, weight - 1));
+	REQUIRE(wib::weight_at_most(v, weight) == weight);
+	REQUIRE(!wib::weight_at_most(v, weight - 1).has_value());
+	// The traversal stops as soon as the limit is crossed
+	visit_counted_t::visits = 0;
+	REQUIRE(wib::exceeds(v, v.capacity() * sizeof(visit_counted_t)));
+	REQUIRE(visit_counted_t::visits == 1);
+	visit_counted_t::visits = 0;
+	REQUIRE(wib::exceeds(v, 0));
+	REQUIRE(visit_counted_t::visits == 0);
+	// Reported through measure
+	{
+		auto options = wib::options_t{};
+		options.byte_limit = 1000;
+		const auto report = wib::measure(v, options);
+		REQUIRE(report.limit_exceeded);
+		REQUIRE(report.bytes > 1000);
+		REQUIRE(report.bytes < weight);
+		options.traversal = wib::etraversal::Iterative;
+		REQUIRE(wib::measure(v, options).limit_exceeded);
+	}
+}
+
+
+TEST_CASE("deadline and node budget") {
+	auto strings = std::vector<std::string>(100'000, std::string(100, ' '));
+	const auto full = wib::measure(strings);
+	REQUIRE(!full.is_lower_bound());
+	REQUIRE(full.nodes_visited == strings.size() + 1);
+	// Node budget
+	{
+		auto options = wib::options_t{};
+		options.node_budget = 1001;
+		const auto report = wib::measure(strings, options);
+		REQUIRE(report.node_budget_exhausted);
+		REQUIRE(report.is_lower_bound());
+		REQUIRE(report.nodes_visited == 1001);
+		REQUIRE(report.bytes == strings.capacity() * sizeof(std::string) + 1000 * strings[0].capacity());
+		// A budget covering every object is not exhausted
+		options.node_budget = full.nodes_visited;
+		const auto exact = wib::measure(strings, options);
+		REQUIRE(!exact.node_budget_exhausted);
+		REQUIRE(exact.nodes_visited == full.nodes_visited);
+		REQUIRE(exact.bytes == full.bytes);
+	}
+	// Deadline
+	{
+		const auto passed = wib::measure_until(strings, std::chrono::steady_clock::now());
+		REQUIRE(passed.deadline_reached);
+		REQUIRE(passed.is_lower_bound());
+		REQUIRE(passed.nodes_visited == wib::detail::deadline_check_interval);
+		REQUIRE(passed.bytes < full.bytes);
+		const auto distant = wib::measure_until(strings, std::chrono::steady_clock::now() + std::chrono::hours{ 1 });
+		REQUIRE(!distant.is_lower_bound());
+		REQUIRE(distant.bytes == full.bytes);
+	}
+}
+
+
 TEST_CASE("raw pointer") {
 	auto uptr = std::make_unique<bytevec_t>();
 	uptr->resize(128);
@@ -254,16 +895,18 @@ TEST_CASE("raw pointer") {
 TEST_CASE("std::set") {
 	auto s = std::set<bytevec_t>{};
 	REQUIRE(wib::weight_in_bytes(s) == 0);
+	constexpr auto node_bytes = wib::node_bytes_v<decltype(s)>;
+	REQUIRE(node_bytes >= sizeof(bytevec_t));
 	s.insert(bytevec_t{});
-	REQUIRE(wib::weight_in_bytes(s) == sizeof(bytevec_t));
+	REQUIRE(wib::weight_in_bytes(s) == node_bytes);
 	s.clear();
 	s.insert(bytevec_t(256));
-	REQUIRE(wib::weight_in_bytes(s) == sizeof(bytevec_t) + 256);
+	REQUIRE(wib::weight_in_bytes(s) == node_bytes + 256);
 	s.insert(bytevec_t(128));
 	REQUIRE(
 		wib::weight_in_bytes(s) == 
-		sizeof(bytevec_t) + 256 +
-		sizeof(bytevec_t) + 128
+		node_bytes + 256 +
+		node_bytes + 128
 	);
 };
 
@@ -272,6 +915,102 @@ TEST_CASE("std::set") {
 
 
 
+TEST_CASE("node containers with heap-free elements") {
+	using it_int_t = iterated_t<int>;
+	using it_double_t = iterated_t<double>;
+	constexpr auto n = 1000;
+	{
+		auto fast = std::map<int, double>{};
+		auto iterated = std::map<it_int_t, it_double_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast[i] = double(i);
+			iterated[it_int_t{ i }] = it_double_t{ double(i) };
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+		REQUIRE(wib::weight_in_bytes(fast) == n * wib::node_bytes_v<decltype(fast)>);
+	}
+	{
+		auto fast = std::multimap<int, double>{};
+		auto iterated = std::multimap<it_int_t, it_double_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert({ 0, double(i) });
+			iterated.insert({ it_int_t{ 0 }, it_double_t{ double(i) } });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+	}
+	{
+		auto fast = std::set<int>{};
+		auto iterated = std::set<it_int_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert(i);
+			iterated.insert(it_int_t{ i });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+		REQUIRE(wib::weight_in_bytes(fast) == n * wib::node_bytes_v<decltype(fast)>);
+	}
+	{
+		auto fast = std::multiset<int>{};
+		auto iterated = std::multiset<it_int_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert(i % 10);
+			iterated.insert(it_int_t{ i % 10 });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+	}
+	{
+		auto fast = std::unordered_map<int, int>{};
+		auto iterated = std::unordered_map<it_int_t, it_int_t, iterated_hash_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast[i] = i;
+			iterated[it_int_t{ i }] = it_int_t{ i };
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+		REQUIRE(wib::weight_in_bytes(fast) == n * wib::node_bytes_v<decltype(fast)> + fast.bucket_count() * sizeof(void*));
+	}
+	{
+		auto fast = std::unordered_multimap<int, int>{};
+		auto iterated = std::unordered_multimap<it_int_t, it_int_t, iterated_hash_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert({ i % 10, i });
+			iterated.insert({ it_int_t{ i % 10 }, it_int_t{ i } });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+	}
+	{
+		auto fast = std::unordered_set<int>{};
+		auto iterated = std::unordered_set<it_int_t, iterated_hash_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert(i);
+			iterated.insert(it_int_t{ i });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+	}
+	{
+		auto fast = std::unordered_multiset<int>{};
+		auto iterated = std::unordered_multiset<it_int_t, iterated_hash_t>{};
+		for (int i = 0; i < n; ++i) {
+			fast.insert(i % 10);
+			iterated.insert(it_int_t{ i % 10 });
+		}
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+	}
+	{
+		auto fast = std::list<double>(n);
+		auto iterated = std::list<it_double_t>(n);
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+		REQUIRE(wib::weight_in_bytes(fast) == n * wib::node_bytes_v<decltype(fast)>);
+	}
+	{
+		auto fast = std::forward_list<double>(n);
+		auto iterated = std::forward_list<it_double_t>(n);
+		REQUIRE(wib::weight_in_bytes(fast) == wib::weight_in_bytes(iterated));
+		REQUIRE(wib::weight_in_bytes(fast) == n * wib::node_bytes_v<decltype(fast)>);
+	}
+}
+
+
+
+
 TEST_CASE("std::map") {
 	
 	{
@@ -282,7 +1021,7 @@ TEST_CASE("std::map") {
 		}
 		REQUIRE(
 			wib::weight_in_bytes(m) ==
-			1000 * sizeof(int) + 1000 * sizeof(double)
+			1000 * wib::node_bytes_v<decltype(m)>
 		);
 	}
 	{
@@ -294,8 +1033,8 @@ TEST_CASE("std::map") {
 		}
 		REQUIRE(
 			wib::weight_in_bytes(m) ==
-			1000 * sizeof(int) + 
-			1000 * sizeof(bytevec_t) +
+			1000 * wib::node_bytes_v<decltype(m)> +
+			m.bucket_count() * sizeof(void*) +
 			1000 * 500
 		);
 	}
@@ -307,7 +1046,7 @@ TEST_CASE("std::map") {
 		}
 		REQUIRE(
 			wib::weight_in_bytes(m) ==
-			1000 * sizeof(int) + 1000 * sizeof(double)
+			1000 * wib::node_bytes_v<decltype(m)>
 		);
 	}
 }
@@ -480,3 +1219,1083 @@ TEST_CASE("cereal-serialize") {
 	}
 };
 
+
+
+namespace {
+// Same members as cereal::NameValuePair
+template <typename T>
+struct name_value_pair_t {
+	const char* name{};
+	const T& value;
+};
+template <typename T>
+auto make_nvp(const char* name, const T& value) -> name_value_pair_t<T> {
+	return name_value_pair_t<T>{ name, value };
+}
+struct citizen_t {
+	template <typename Ar>
+	auto serialize(Ar& ar) -> void {
+		ar(make_nvp("name_", name_), make_nvp("age_", age_));
+	}
+	std::string name_{};
+	int age_{};
+};
+struct street_t {
+	template <typename Ar>
+	auto serialize(Ar& ar) -> void {
+		ar(numbers_);
+	}
+	std::vector<int> numbers_{};
+};
+struct town_t {
+	template <typename Ar>
+	auto serialize(Ar& ar) -> void {
+		ar(make_nvp("citizens_", citizens_), make_nvp("streets_", streets_));
+		ar(make_nvp("mayor_", mayor_));
+	}
+	std::vector<citizen_t> citizens_{};
+	std::vector<street_t> streets_{};
+	std::unique_ptr<citizen_t> mayor_{};
+};
+auto make_town() -> town_t {
+	auto town = town_t{};
+	for (auto i = 0; i < 3; ++i) {
+		town.citizens_.push_back(citizen_t{ std::string(100 + i, 'c'), i });
+	}
+	town.streets_.resize(2);
+	town.streets_[0].numbers_.resize(10);
+	town.streets_[1].numbers_.resize(20);
+	town.mayor_ = std::make_unique<citizen_t>(citizen_t{ std::string(200, 'm'), 50 });
+	return town;
+}
+}
+TEST_CASE("breakdown") {
+	static_assert(wib::detail::type_traits::is_name_value_pair_v<name_value_pair_t<int>>);
+	static_assert(!wib::detail::type_traits::is_name_value_pair_v<citizen_t>);
+	const auto town = make_town();
+	auto names_bytes = size_t{ 0 };
+	for (const auto& citizen : town.citizens_) {
+		names_bytes += wib::weight_in_bytes(citizen.name_);
+	}
+	for (const auto traversal : { wib::etraversal::Recursive, wib::etraversal::Iterative }) {
+		auto options = wib::options_t{};
+		options.traversal = traversal;
+		const auto root = wib::breakdown(town, options);
+		auto paths = std::map<std::string, const wib::breakdown_node_t*>{};
+		wib::for_each_path(root, [&paths](const std::string& path, const wib::breakdown_node_t& node) {
+			paths.emplace(path, &node);
+		});
+		REQUIRE(paths.size() == 9);
+		REQUIRE(root.inclusive_bytes == wib::weight_in_bytes(town));
+		REQUIRE(root.exclusive_bytes == 0);
+		REQUIRE(root.count == 1);
+		REQUIRE(paths.at("citizens_")->exclusive_bytes == town.citizens_.capacity() * sizeof(citizen_t));
+		REQUIRE(paths.at("citizens_")->heap_blocks == 1);
+		REQUIRE(paths.at("citizens_[*]")->count == 3);
+		REQUIRE(paths.at("citizens_[*]")->exclusive_bytes == 0);
+		REQUIRE(paths.at("citizens_[*].name_")->count == 3);
+		REQUIRE(paths.at("citizens_[*].name_")->exclusive_bytes == names_bytes);
+		REQUIRE(paths.at("citizens_[*].name_")->heap_blocks == 3);
+		REQUIRE(paths.at("citizens_")->inclusive_bytes == paths.at("citizens_")->exclusive_bytes + names_bytes);
+		// Members without reflected names are named by index
+		REQUIRE(paths.at("streets_[*].0")->count == 2);
+		REQUIRE(paths.at("streets_[*].0")->exclusive_bytes == 30 * sizeof(int));
+		// Pointees are attributed to the pointer
+		REQUIRE(paths.at("mayor_")->exclusive_bytes == sizeof(citizen_t));
+		REQUIRE(paths.at("mayor_.name_")->exclusive_bytes == wib::weight_in_bytes(town.mayor_->name_));
+		REQUIRE(paths.count("citizens_[*].age_") == 0);
+	}
+	// std::pair members are named first and second
+	{
+		auto m = std::map<int, std::string>{ { 1, std::string(100, 'a') }, { 2, std::string(100, 'b') } };
+		const auto root = wib::breakdown(m);
+		REQUIRE(root.inclusive_bytes == wib::weight_in_bytes(m));
+		REQUIRE(root.children.size() == 1);
+		REQUIRE(root.children[0].name == "[*]");
+		REQUIRE(root.children[0].count == 2);
+		REQUIRE(root.children[0].children.size() == 1);
+		REQUIRE(root.children[0].children[0].name == "second");
+		REQUIRE(root.children[0].children[0].heap_blocks == 2);
+	}
+	// Recursive paths are folded into the ancestor of the same type, so chains
+	// deeper than the thread stack give a shallow tree
+	{
+		constexpr auto length = size_t{ 200'000 };
+		auto head = make_chain(length);
+		head->next->next->payload.resize(100);
+		auto options = wib::options_t{};
+		options.traversal = wib::etraversal::Iterative;
+		const auto root = wib::breakdown(head, options);
+		auto paths = std::map<std::string, const wib::breakdown_node_t*>{};
+		wib::for_each_path(root, [&paths](const std::string& path, const wib::breakdown_node_t& node) {
+			paths.emplace(path, &node);
+		});
+		REQUIRE(paths.size() == 4);
+		REQUIRE(root.inclusive_bytes == wib::weight_in_bytes(head, options));
+		REQUIRE(paths.at("1")->count == length);
+		REQUIRE(paths.at("1")->exclusive_bytes == (length - 1) * wib::make_shared_bytes_v<chain_node_t>);
+		REQUIRE(paths.at("1.0")->exclusive_bytes == 100);
+		REQUIRE(wib::slack_report(head, options).by_path.size() == 1);
+		auto os = std::ostringstream{};
+		wib::write_snapshot(os, root, wib::weight_by_type(head, options));
+		REQUIRE(!os.str().empty());
+		destroy_chain(head);
+	}
+}
+
+
+TEST_CASE("weight_by_type") {
+	struct node_t {
+		auto as_tuple() const { return std::tie(payload, next); }
+		std::vector<float> payload{};
+		std::shared_ptr<node_t> next{};
+	};
+	auto head = std::make_shared<node_t>();
+	head->payload.resize(10);
+	head->next = std::make_shared<node_t>();
+	head->next->payload.resize(20);
+	auto v = std::vector<std::shared_ptr<node_t>>{ head, head->next };
+	const auto weights = wib::weight_by_type(v);
+	const auto& vector_weight = weights.at(typeid(std::vector<std::shared_ptr<node_t>>));
+	REQUIRE(vector_weight.bytes == v.capacity() * sizeof(std::shared_ptr<node_t>));
+	REQUIRE(vector_weight.instances == 1);
+	REQUIRE(vector_weight.heap_blocks == 1);
+	// Pointees are attributed to the type pointed to, and shared ones counted once
+	const auto& node_weight = weights.at(typeid(node_t));
+	REQUIRE(node_weight.bytes == 2 * wib::make_shared_bytes_v<node_t>);
+	REQUIRE(node_weight.instances == 2);
+	REQUIRE(node_weight.heap_blocks == 2);
+	const auto& payload_weight = weights.at(typeid(std::vector<float>));
+	REQUIRE(payload_weight.bytes == (head->payload.capacity() + head->next->payload.capacity()) * sizeof(float));
+	REQUIRE(payload_weight.instances == 2);
+	auto total = size_t{ 0 };
+	for (const auto& entry : weights) {
+		total += entry.second.bytes;
+	}
+	REQUIRE(total == wib::weight_in_bytes(v));
+	// Strings of the town
+	const auto town = make_town();
+	const auto town_weights = wib::weight_by_type(town);
+	const auto& string_weight = town_weights.at(typeid(std::string));
+	REQUIRE(string_weight.instances == 4);
+	REQUIRE(string_weight.heap_blocks == 4);
+}
+
+
+TEST_CASE("slack_report") {
+	auto town = make_town();
+	town.citizens_.reserve(10);
+	town.streets_[0].numbers_.clear();
+	town.streets_[1].numbers_.resize(5);
+	const auto report = wib::slack_report(town);
+	const auto& citizens = report.by_path.at("citizens_");
+	REQUIRE(citizens.containers == 1);
+	REQUIRE(citizens.used_bytes == 3 * sizeof(citizen_t));
+	REQUIRE(citizens.slack_bytes == (town.citizens_.capacity() - 3) * sizeof(citizen_t));
+	const auto& numbers = report.by_path.at("streets_[*].0");
+	REQUIRE(numbers.containers == 2);
+	REQUIRE(numbers.used_bytes == 5 * sizeof(int));
+	REQUIRE(numbers.slack_bytes == (10 + 20 - 5) * sizeof(int));
+	const auto& names = report.by_path.at("citizens_[*].name_");
+	REQUIRE(names.containers == 3);
+	REQUIRE(report.by_path.count("mayor_") == 0);
+	const auto& strings = report.by_type.at(typeid(std::string));
+	REQUIRE(strings.containers == 4);
+	auto used_bytes = size_t{ 0 };
+	auto slack_bytes = size_t{ 0 };
+	for (const auto& entry : report.by_type) {
+		used_bytes += entry.second.used_bytes;
+		slack_bytes += entry.second.slack_bytes;
+	}
+	REQUIRE(used_bytes == report.used_bytes);
+	REQUIRE(slack_bytes == report.slack_bytes);
+	// Everything but the mayor pointee is owned by containers with capacity
+	REQUIRE(report.used_bytes + report.slack_bytes + sizeof(citizen_t) == wib::weight_in_bytes(town));
+}
+
+
+TEST_CASE("shrink_to_fit_all") {
+	auto town = make_town();
+	town.citizens_.reserve(100);
+	town.citizens_[0].name_.reserve(1000);
+	town.streets_[0].numbers_.clear();
+	town.mayor_->name_.resize(20);
+	const auto slack_before = wib::slack_report(town).slack_bytes;
+	const auto weight_before = wib::weight_in_bytes(town);
+	REQUIRE(slack_before > 0);
+	// Nothing passes the threshold
+	REQUIRE(wib::shrink_to_fit_all(town, weight_before) == 0);
+	REQUIRE(wib::weight_in_bytes(town) == weight_before);
+	// Only the citizens buffer passes the threshold
+	const auto citizens_slack = (town.citizens_.capacity() - town.citizens_.size()) * sizeof(citizen_t);
+	REQUIRE(wib::shrink_to_fit_all(town, citizens_slack) == citizens_slack);
+	REQUIRE(town.citizens_.capacity() == town.citizens_.size());
+	REQUIRE(town.citizens_[0].name_.capacity() >= 1000);
+	// Everything, the reclaimed bytes matches the change in weight
+	const auto weight_middle = wib::weight_in_bytes(town);
+	const auto reclaimed = wib::shrink_to_fit_all(town);
+	REQUIRE(reclaimed > 0);
+	REQUIRE(wib::weight_in_bytes(town) == weight_middle - reclaimed);
+	REQUIRE(town.streets_[0].numbers_.capacity() == 0);
+	REQUIRE(town.citizens_[0].name_.capacity() < 1000);
+	REQUIRE(wib::slack_report(town).slack_bytes < slack_before);
+	// Through as_tuple(), maps, std::variant and shared pointees reached twice
+	{
+		struct holder_t {
+			auto as_tuple() const { return std::tie(m, var, sptr0, sptr1); }
+			std::map<int, std::vector<int>> m{};
+			std::variant<int, std::vector<int>> var{};
+			std::shared_ptr<std::vector<int>> sptr0{};
+			std::shared_ptr<std::vector<int>> sptr1{};
+		};
+		auto holder = holder_t{};
+		holder.m[0].reserve(100);
+		holder.var = std::vector<int>{};
+		std::get<1>(holder.var).reserve(100);
+		holder.sptr0 = std::make_shared<std::vector<int>>();
+		holder.sptr0->reserve(100);
+		holder.sptr1 = holder.sptr0;
+		REQUIRE(wib::shrink_to_fit_all(holder) == 3 * 100 * sizeof(int));
+		REQUIRE(holder.m[0].capacity() == 0);
+	}
+}
+
+
+TEST_CASE("size_histogram") {
+	auto v = std::vector<std::string>{};
+	v.reserve(4);
+	v.emplace_back(100, 'a');
+	v.emplace_back(200, 'b');
+	v.emplace_back(3000, 'c');
+	v.emplace_back("short");
+	auto s = std::set<int>{ 1, 2, 3 };
+	const auto tpl = std::tie(v, s);
+	const auto report = wib::measure(tpl);
+	// Power of two classes
+	{
+		const auto histogram = wib::size_histogram(tpl);
+		REQUIRE(histogram.upper_bounds.size() == 65);
+		REQUIRE(histogram.upper_bounds[7] == 128);
+		auto blocks = size_t{ 0 };
+		auto bytes = size_t{ 0 };
+		for (size_t i = 0; i < histogram.blocks.size(); ++i) {
+			blocks += histogram.blocks[i];
+			bytes += histogram.bytes[i];
+		}
+		REQUIRE(blocks == report.heap_blocks);
+		REQUIRE(bytes == report.bytes);
+		REQUIRE(histogram.blocks[7] == (v[0].capacity() <= 128 ? 2 : 1));
+		REQUIRE(histogram.blocks[12] == 1);
+		REQUIRE(histogram.blocks[6] == (wib::node_bytes_v<std::set<int>> == 40 ? 3 : 0));
+	}
+	// Custom classes
+	{
+		const auto histogram = wib::size_histogram(tpl, { 64, 1024 });
+		REQUIRE(histogram.upper_bounds.size() == 3);
+		REQUIRE(histogram.blocks[0] == 3);
+		REQUIRE(histogram.blocks[1] == 3);
+		REQUIRE(histogram.blocks[2] == 1);
+		REQUIRE(histogram.bytes[2] == v[2].capacity());
+	}
+	// Custom weight_in_bytes() is not split into blocks
+	{
+		struct custom_t {
+			auto weight_in_bytes() const -> size_t { return 77; }
+		};
+		const auto histogram = wib::size_histogram(custom_t{});
+		REQUIRE(histogram.opaque_bytes == 77);
+	}
+}
+
+
+TEST_CASE("top_n") {
+	auto town = make_town();
+	town.citizens_[1].name_.resize(5000);
+	town.streets_[1].numbers_.resize(2000);
+	for (const auto traversal : { wib::etraversal::Recursive, wib::etraversal::Iterative }) {
+		auto options = wib::options_t{};
+		options.traversal = traversal;
+		const auto top = wib::top_n(town, 3, options);
+		REQUIRE(top.size() == 3);
+		REQUIRE(top[0].path == "streets_[1].0");
+		REQUIRE(top[0].bytes == town.streets_[1].numbers_.capacity() * sizeof(int));
+		REQUIRE(top[0].type == typeid(std::vector<int>));
+		REQUIRE(top[1].path == "citizens_[1].name_");
+		REQUIRE(top[1].type == typeid(std::string));
+		REQUIRE(top[2].path == "mayor_.name_");
+	}
+	// Pointees are reported at the path of the pointer, nodes at the path of the container
+	{
+		auto m = std::map<int, int>{ { 1, 1 }, { 2, 2 } };
+		const auto t = std::make_tuple(std::make_unique<std::array<char, 1000>>(), m);
+		const auto top = wib::top_n(t, 10);
+		REQUIRE(top.size() == 3);
+		REQUIRE(top[0].path == "0");
+		REQUIRE(top[0].type == typeid(std::array<char, 1000>));
+		REQUIRE(top[1].path == "1");
+		REQUIRE(top[2].path == "1");
+	}
+	REQUIRE(wib::top_n(town, 0).empty());
+}
+
+
+namespace {
+// Top level fields of a protobuf message, as (field number, varint value or bytes)
+struct protobuf_field_t {
+	uint32_t number{};
+	uint64_t varint{};
+	std::string bytes{};
+};
+auto read_varint(const std::string& buffer, size_t& io_pos) -> uint64_t {
+	auto value = uint64_t{ 0 };
+	for (auto shift = 0; ; shift += 7) {
+		const auto byte = static_cast<uint8_t>(buffer.at(io_pos++));
+		value |= uint64_t{ byte & 0x7Fu } << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+}
+auto read_protobuf(const std::string& buffer) -> std::vector<protobuf_field_t> {
+	auto fields = std::vector<protobuf_field_t>{};
+	auto pos = size_t{ 0 };
+	while (pos < buffer.size()) {
+		const auto tag = read_varint(buffer, pos);
+		auto field = protobuf_field_t{ static_cast<uint32_t>(tag >> 3) };
+		if ((tag & 7) == 0) {
+			field.varint = read_varint(buffer, pos);
+		}
+		else {
+			if ((tag & 7) != 2) {
+				throw std::runtime_error{ "unexpected wire type" };
+			}
+			const auto size = read_varint(buffer, pos);
+			field.bytes = buffer.substr(pos, size);
+			pos += size;
+		}
+		fields.push_back(field);
+	}
+	return fields;
+}
+}
+TEST_CASE("write_folded_stacks and write_pprof") {
+	const auto town = make_town();
+	const auto root = wib::breakdown(town);
+	// Folded stacks
+	{
+		auto os = std::ostringstream{};
+		wib::write_folded_stacks(os, root);
+		auto is = std::istringstream{ os.str() };
+		auto lines = std::map<std::string, size_t>{};
+		auto stack = std::string{};
+		auto bytes = size_t{ 0 };
+		while (is >> stack >> bytes) {
+			lines[stack] = bytes;
+		}
+		REQUIRE(lines.size() == 6);
+		REQUIRE(lines.at("root;citizens_") == town.citizens_.capacity() * sizeof(citizen_t));
+		REQUIRE(lines.count("root;citizens_;[*];name_") == 1);
+		REQUIRE(lines.count("root;streets_;[*];0") == 1);
+		auto total = size_t{ 0 };
+		for (const auto& line : lines) {
+			total += line.second;
+		}
+		REQUIRE(total == root.inclusive_bytes);
+	}
+	// pprof
+	{
+		auto os = std::ostringstream{};
+		wib::write_pprof(os, root, "town");
+		const auto fields = read_protobuf(os.str());
+		auto strings = std::vector<std::string>{};
+		auto function_count = size_t{ 0 };
+		auto location_count = size_t{ 0 };
+		auto total = size_t{ 0 };
+		auto max_stack = size_t{ 0 };
+		for (const auto& field : fields) {
+			switch (field.number) {
+			case 6: strings.push_back(field.bytes); break;
+			case 5: ++function_count; break;
+			case 4: ++location_count; break;
+			case 2: {
+				const auto sample = read_protobuf(field.bytes);
+				auto pos = size_t{ 0 };
+				auto depth = size_t{ 0 };
+				while (pos < sample[0].bytes.size()) {
+					read_varint(sample[0].bytes, pos);
+					++depth;
+				}
+				max_stack = std::max(max_stack, depth);
+				pos = 0;
+				read_varint(sample[1].bytes, pos);
+				total += read_varint(sample[1].bytes, pos);
+				break;
+			}
+			default: break;
+			}
+		}
+		REQUIRE(strings.at(0).empty());
+		REQUIRE(strings.at(3) == "inuse_space");
+		REQUIRE(strings.at(5) == "town");
+		REQUIRE(function_count == location_count);
+		REQUIRE(strings.size() == 5 + function_count);
+		REQUIRE(total == root.inclusive_bytes);
+		REQUIRE(max_stack == 4);
+	}
+	// Written during the traversal, a path may be split over several lines
+	auto sum_lines_f = [](const std::string& folded) {
+		auto is = std::istringstream{ folded };
+		auto lines = std::map<std::string, size_t>{};
+		auto stack = std::string{};
+		auto bytes = size_t{ 0 };
+		while (is >> stack >> bytes) {
+			lines[stack] += bytes;
+		}
+		return lines;
+	};
+	{
+		auto from_tree = std::ostringstream{};
+		wib::write_folded_stacks(from_tree, root);
+		for (const auto traversal : { wib::etraversal::Recursive, wib::etraversal::Iterative }) {
+			auto options = wib::options_t{};
+			options.traversal = traversal;
+			auto streamed = std::ostringstream{};
+			wib::write_folded_stacks(streamed, town, "root", options);
+			REQUIRE(sum_lines_f(streamed.str()) == sum_lines_f(from_tree.str()));
+			auto pprof = std::ostringstream{};
+			wib::write_pprof(pprof, town, "town", options);
+			auto total = size_t{ 0 };
+			for (const auto& field : read_protobuf(pprof.str())) {
+				if (field.number == 2) {
+					const auto sample = read_protobuf(field.bytes);
+					auto pos = size_t{ 0 };
+					read_varint(sample[1].bytes, pos);
+					total += read_varint(sample[1].bytes, pos);
+				}
+			}
+			REQUIRE(total == root.inclusive_bytes);
+		}
+	}
+	// Elements of a range are merged into a single line, recursive paths are
+	// folded as by breakdown()
+	{
+		const auto strings = std::vector<std::string>(1000, std::string(100, 'a'));
+		auto os = std::ostringstream{};
+		wib::write_folded_stacks(os, strings);
+		const auto folded = os.str();
+		REQUIRE(std::count(folded.begin(), folded.end(), '\n') == 2);
+		constexpr auto length = size_t{ 200'000 };
+		auto head = make_chain(length);
+		auto options = wib::options_t{};
+		options.traversal = wib::etraversal::Iterative;
+		auto chain = std::ostringstream{};
+		wib::write_folded_stacks(chain, head, "root", options);
+		const auto lines = sum_lines_f(chain.str());
+		REQUIRE(lines.size() == 2);
+		REQUIRE(lines.at("root;1") == (length - 1) * wib::make_shared_bytes_v<chain_node_t>);
+		destroy_chain(head);
+	}
+}
+
+
+TEST_CASE("snapshots") {
+	auto town = make_town();
+	auto write_f = [](const town_t& t) -> std::vector<uint64_t> {
+		auto os = std::ostringstream{};
+		wib::write_snapshot(os, wib::breakdown(t), wib::weight_by_type(t));
+		const auto str = os.str();
+		// Aligned storage, as a memory mapped file would be
+		auto storage = std::vector<uint64_t>((str.size() + 7) / 8);
+		std::memcpy(storage.data(), str.data(), str.size());
+		storage.push_back(str.size());
+		return storage;
+	};
+	auto view_f = [](const std::vector<uint64_t>& storage) -> wib::snapshot_view_t {
+		const auto view = wib::snapshot_view_t::from_bytes(storage.data(), static_cast<size_t>(storage.back()));
+		REQUIRE(view.has_value());
+		return *view;
+	};
+	const auto before_storage = write_f(town);
+	const auto before = view_f(before_storage);
+	REQUIRE(before.paths().size() == 9);
+	auto found = false;
+	for (const auto& record : before.paths()) {
+		if (before.name(record) == "citizens_[*].name_") {
+			found = true;
+			REQUIRE(record.count == 3);
+			REQUIRE(record.heap_blocks == 3);
+		}
+	}
+	REQUIRE(found);
+	REQUIRE(before.types().size() == wib::weight_by_type(town).size());
+	// Invalid data
+	{
+		auto corrupt = before_storage;
+		corrupt[0] = 0;
+		REQUIRE(!wib::snapshot_view_t::from_bytes(corrupt.data(), static_cast<size_t>(before_storage.back())).has_value());
+		REQUIRE(!wib::snapshot_view_t::from_bytes(before_storage.data(), sizeof(wib::snapshot_header_t) - 1).has_value());
+		REQUIRE(!wib::snapshot_view_t::from_bytes(before_storage.data(), sizeof(wib::snapshot_header_t) + 8).has_value());
+	}
+	// Crafted headers
+	{
+		const auto size = static_cast<size_t>(before_storage.back());
+		auto header_f = [&before_storage]() {
+			auto header = wib::snapshot_header_t{};
+			std::memcpy(static_cast<void*>(&header), before_storage.data(), sizeof(header));
+			return header;
+		};
+		auto from_header_f = [&before_storage, size](const wib::snapshot_header_t& header) {
+			auto crafted = before_storage;
+			std::memcpy(crafted.data(), &header, sizeof(header));
+			return wib::snapshot_view_t::from_bytes(crafted.data(), size).has_value();
+		};
+		REQUIRE(from_header_f(header_f()));
+		// The sum of the counts wraps around to a valid count
+		auto overflowing = header_f();
+		overflowing.type_count = std::numeric_limits<uint64_t>::max() - overflowing.path_count + 2;
+		REQUIRE(!from_header_f(overflowing));
+		overflowing = header_f();
+		overflowing.path_count = std::numeric_limits<uint64_t>::max();
+		overflowing.type_count = 1;
+		REQUIRE(!from_header_f(overflowing));
+		// The names overlap the records
+		auto overlapping = header_f();
+		overlapping.names_offset = overlapping.records_offset;
+		REQUIRE(!from_header_f(overlapping));
+		overlapping = header_f();
+		overlapping.names_offset = overlapping.records_offset - 8;
+		overlapping.names_size = 16;
+		REQUIRE(!from_header_f(overlapping));
+	}
+	// Diff
+	town.streets_[0].numbers_ = std::vector<int>(1000);
+	town.citizens_.clear();
+	town.citizens_.shrink_to_fit();
+	const auto after_storage = write_f(town);
+	const auto after = view_f(after_storage);
+	const auto deltas = wib::diff_snapshots(before.paths(), before, after.paths(), after, 2);
+	REQUIRE(deltas.size() == 2);
+	REQUIRE(deltas[0].name == "streets_[*].0");
+	REQUIRE(deltas[0].delta() == static_cast<int64_t>(sizeof(int) * (1000 - 10)));
+	REQUIRE(deltas[1].name == "citizens_[*].name_");
+	REQUIRE(deltas[1].bytes_after == 0);
+	REQUIRE(deltas[1].count_before == 3);
+	const auto all_deltas = wib::diff_snapshots(before.paths(), before, after.paths(), after, 100);
+	REQUIRE(all_deltas.size() == 3);
+	const auto type_deltas = wib::diff_snapshots(before.types(), before, after.types(), after, 100);
+	REQUIRE(type_deltas.size() == 3);
+	REQUIRE(wib::diff_snapshots(before.paths(), before, before.paths(), before, 100).empty());
+}
+
+
+TEST_CASE("traversal statistics") {
+	auto shared = std::make_shared<std::string>(100, 's');
+	auto v = std::vector<std::shared_ptr<std::string>>(10, shared);
+	const auto t = std::make_tuple(v, std::vector<int>(100), std::list<int>{ 1, 2, 3 });
+	const auto stats = wib::measure(t).stats;
+	REQUIRE(stats.nodes_visited == wib::measure(t).nodes_visited);
+	REQUIRE(stats.pointers_deduplicated == 9);
+	// The string and its control block
+	REQUIRE(stats.address_set_peak_size == 2);
+	REQUIRE(stats.address_set_probes >= 10);
+	// tuple -> vector -> shared_ptr -> string
+	REQUIRE(stats.max_depth_reached == 3);
+	REQUIRE(stats.ranges_walked == 1);
+	// The characters of the string, the ints of the vector and the list
+	REQUIRE(stats.ranges_short_circuited == 3);
+	REQUIRE(stats.wall_time.count() > 0);
+	const auto parallel_stats = wib::measure(std::execution::par, t).stats;
+	REQUIRE(parallel_stats.pointers_deduplicated == 9);
+	REQUIRE(parallel_stats.max_depth_reached == 3);
+	REQUIRE(parallel_stats.ranges_walked == 1);
+}
+
+
+namespace {
+// Sums the bytes below each member of the root object
+struct bytes_per_member_visitor_t {
+	auto enter(const wib::segment_t& segment) -> void {
+		if (path.empty()) {
+			current = std::string{ segment.name };
+		}
+		path.push_back(segment);
+	}
+	auto leave() -> void {
+		path.pop_back();
+	}
+	auto block(const wib::block_t& block) -> void {
+		bytes[current] += block.bytes;
+	}
+	auto pointer(const void*, const std::type_info&, bool is_first_visit) -> void {
+		++(is_first_visit ? first_visits : repeated_visits);
+	}
+	auto unknown_type(const std::type_info& type) -> void {
+		unknown.emplace(type);
+	}
+	std::vector<wib::segment_t> path{};
+	std::string current{};
+	std::map<std::string, size_t> bytes{};
+	size_t first_visits{};
+	size_t repeated_visits{};
+	wib::typeindex_set_t unknown{};
+};
+}
+TEST_CASE("visit") {
+	auto town = make_town();
+	town.citizens_.push_back(town.citizens_.front());
+	{
+		auto visitor = bytes_per_member_visitor_t{};
+		const auto report = wib::visit(town, visitor);
+		REQUIRE(report.bytes == wib::weight_in_bytes(town));
+		REQUIRE(visitor.path.empty());
+		REQUIRE(visitor.bytes.at("citizens_") == wib::weight_in_bytes(town.citizens_));
+		REQUIRE(visitor.bytes.at("streets_") == wib::weight_in_bytes(town.streets_));
+		REQUIRE(visitor.bytes.at("mayor_") == wib::weight_in_bytes(town.mayor_));
+		REQUIRE(visitor.first_visits == 1);
+	}
+	// Pointer edges and unknown types, visitors without path hooks are visited recursively
+	{
+		struct unknown_t {
+			std::array<std::string, 2> strings{};
+		};
+		auto shared = std::make_shared<std::string>(100, 's');
+		const auto t = std::make_tuple(shared, shared, unknown_t{});
+		auto visitor = bytes_per_member_visitor_t{};
+		auto options = wib::options_t{};
+		options.traversal = wib::etraversal::Iterative;
+		const auto report = wib::visit(t, visitor, options);
+		REQUIRE(visitor.first_visits == 1);
+		REQUIRE(visitor.repeated_visits == 1);
+		REQUIRE(visitor.unknown.count(typeid(unknown_t)) == 1);
+		REQUIRE(report.unknown_types == visitor.unknown);
+		REQUIRE(visitor.bytes.at("") == wib::weight_in_bytes(t));
+	}
+	// Visitors without any hooks
+	{
+		struct empty_visitor_t {};
+		auto visitor = empty_visitor_t{};
+		REQUIRE(wib::visit(town, visitor).bytes == wib::weight_in_bytes(town));
+	}
+}
+
+
+TEST_CASE("allocator models") {
+	REQUIRE(wib::glibc_allocator_model(1) == 32);
+	REQUIRE(wib::glibc_allocator_model(24) == 32);
+	REQUIRE(wib::glibc_allocator_model(25) == 48);
+	REQUIRE(wib::glibc_allocator_model(129) == 144);
+	REQUIRE(wib::glibc_allocator_model(200'000) == 200'704);
+	REQUIRE(wib::jemalloc_allocator_model(1) == 8);
+	REQUIRE(wib::jemalloc_allocator_model(100) == 112);
+	REQUIRE(wib::jemalloc_allocator_model(129) == 160);
+	REQUIRE(wib::jemalloc_allocator_model(4097) == 5120);
+	REQUIRE(wib::jemalloc_allocator_model(200'000) == 229'376);
+	REQUIRE(wib::tcmalloc_allocator_model(1) == 8);
+	REQUIRE(wib::tcmalloc_allocator_model(129) == 144);
+	REQUIRE(wib::tcmalloc_allocator_model(262'144) == 262'144);
+	REQUIRE(wib::tcmalloc_allocator_model(262'145) == 270'336);
+	// Applied to every block
+	auto v = std::vector<std::string>{};
+	v.reserve(3);
+	v.emplace_back(100, 'a');
+	v.emplace_back(129, 'b');
+	auto s = std::set<int>{ 1, 2 };
+	const auto t = std::tie(v, s);
+	auto options = wib::options_t{};
+	options.allocator_model = &wib::glibc_allocator_model;
+	REQUIRE(
+		wib::weight_in_bytes(t, options) ==
+		wib::glibc_allocator_model(3 * sizeof(std::string)) +
+		wib::glibc_allocator_model(v[0].capacity()) +
+		wib::glibc_allocator_model(v[1].capacity()) +
+		2 * wib::glibc_allocator_model(wib::node_bytes_v<std::set<int>>)
+	);
+	// Rounding is reported next to the slack, which keeps its meaning
+	options.allocator_model = [](size_t bytes) -> size_t { return bytes * 2; };
+	const auto slack = wib::slack_report(v, options);
+	const auto unrounded = wib::slack_report(v);
+	REQUIRE(slack.used_bytes == unrounded.used_bytes);
+	REQUIRE(slack.slack_bytes == unrounded.slack_bytes);
+	REQUIRE(unrounded.rounding_bytes == 0);
+	REQUIRE(slack.rounding_bytes == wib::weight_in_bytes(v));
+	REQUIRE(slack.used_bytes + slack.slack_bytes + slack.rounding_bytes == 2 * wib::weight_in_bytes(v));
+}
+
+
+
+#ifdef __GLIBC__
+// Every operator new is served by malloc, live_heap_bytes counts the usable
+// size of the blocks alive while requested_bytes and allocation_count only
+// grow
+namespace {
+auto live_heap_bytes = std::atomic<size_t>{ 0 };
+auto requested_bytes = std::atomic<size_t>{ 0 };
+auto allocation_count = std::atomic<size_t>{ 0 };
+auto counted_malloc(size_t bytes) -> void* {
+	auto* ptr = std::malloc(bytes == 0 ? 1 : bytes);
+	if (ptr != nullptr) {
+		live_heap_bytes += ::malloc_usable_size(ptr);
+		requested_bytes += bytes;
+		++allocation_count;
+	}
+	return ptr;
+}
+auto counted_free(void* ptr) -> void {
+	if (ptr != nullptr) {
+		live_heap_bytes -= ::malloc_usable_size(ptr);
+		std::free(ptr);
+	}
+}
+}
+
+void* operator new(size_t bytes) {
+	if (auto* ptr = counted_malloc(bytes)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+void* operator new[](size_t bytes) { return operator new(bytes); }
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept { return counted_malloc(bytes); }
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept { return counted_malloc(bytes); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+
+namespace {
+// Container with data() and std::allocator whose buffer is not a malloc block
+struct pool_buffer_t {
+	using value_type = char;
+	using allocator_type = std::allocator<char>;
+	auto data() const -> const char* { return pool + 16; }
+	auto size() const -> size_t { return 8; }
+	auto capacity() const -> size_t { return 8; }
+	auto begin() const -> const char* { return data(); }
+	auto end() const -> const char* { return data() + size(); }
+	const char* pool{};
+};
+// Allocated by a class-specific operator new from a static arena
+struct arena_object_t {
+	static auto operator new(size_t) -> void* { return arena; }
+	static auto operator delete(void*) -> void {}
+	alignas(std::max_align_t) static inline char arena[64] = {};
+	double value{};
+};
+}
+
+TEST_CASE("malloc_usable_size block sizes") {
+	auto options = wib::options_t{};
+	options.block_sizes = wib::eblock_sizes::MallocUsableSize;
+	const auto live_before = live_heap_bytes.load();
+	auto v = std::vector<std::string>{};
+	v.reserve(3);
+	v.emplace_back(100, 'a');
+	v.emplace_back(129, 'b');
+	v.emplace_back("short");
+	auto p = std::make_unique<std::vector<int>>(std::vector<int>{ 1, 2, 3 });
+	const auto live_after = live_heap_bytes.load();
+	REQUIRE(wib::weight_in_bytes(std::tie(v, p), options) == live_after - live_before);
+	REQUIRE(wib::weight_in_bytes(std::tie(v, p)) < live_after - live_before);
+	// Takes precedence over the allocator model for known block starts
+	const auto exact_bytes = wib::weight_in_bytes(v, options);
+	options.allocator_model = [](size_t bytes) -> size_t { return bytes * 100; };
+	REQUIRE(wib::weight_in_bytes(v, options) == exact_bytes);
+	// Blocks with unknown start are computed
+	const auto l = std::list<int>{ 1 };
+	REQUIRE(wib::weight_in_bytes(l, options) == 100 * wib::weight_in_bytes(l));
+	// Other containers with data() and std::allocator may not own a malloc block
+	static char pool[64] = {};
+	options.allocator_model = nullptr;
+	REQUIRE(wib::weight_in_bytes(pool_buffer_t{ pool }, options) == 8);
+	// Strings in their inline buffer own no block
+	REQUIRE(wib::weight_in_bytes(std::string{ "short" }, options) == 0);
+	// Pointees with a class-specific operator new may not be malloc blocks
+	static_assert(wib::detail::type_traits::has_member_operator_new_v<arena_object_t>);
+	static_assert(!wib::detail::type_traits::has_member_operator_new_v<std::string>);
+	const auto arena_object = std::unique_ptr<arena_object_t>(new arena_object_t{});
+	REQUIRE(wib::weight_in_bytes(arena_object, options) == sizeof(arena_object_t));
+}
+
+TEST_CASE("measurement_context_t steady state allocations") {
+	struct entry_t {
+		auto as_tuple() const { return std::tie(key, values, shared, nested); }
+		std::string key{};
+		std::vector<int> values{};
+		std::shared_ptr<bytevec_t> shared{};
+		std::map<int, std::vector<std::string>> nested{};
+	};
+	auto entries = std::vector<entry_t>(100);
+	for (auto& entry : entries) {
+		entry.key.assign(40, 'k');
+		entry.values.resize(10);
+		entry.shared = std::make_shared<bytevec_t>(10);
+		entry.nested[0] = { std::string(50, 'a') };
+	}
+	for (const auto traversal : { wib::etraversal::Recursive, wib::etraversal::Iterative }) {
+		auto options = wib::options_t{};
+		options.traversal = traversal;
+		auto context = wib::measurement_context_t{};
+		const auto expected = wib::weight_in_bytes(context, entries, options);
+		const auto count_before = allocation_count.load();
+		auto bytes = size_t{ 0 };
+		for (int i = 0; i < 10; ++i) {
+			bytes += wib::weight_in_bytes(context, entries, options);
+			bytes += wib::measure(context, entries, options).bytes;
+		}
+		const auto count = allocation_count.load() - count_before;
+		REQUIRE(count == 0);
+		REQUIRE(bytes == 20 * expected);
+	}
+}
+
+struct throwing_hash_t {
+	auto operator()(int v) const -> size_t { return static_cast<size_t>(v); }
+};
+
+// The container made by make() must not free anything while constructed
+template <typename F>
+auto require_allocations_match(F&& make) -> void {
+	const auto bytes_before = requested_bytes.load();
+	const auto count_before = allocation_count.load();
+	const auto value = make();
+	const auto bytes = requested_bytes.load() - bytes_before;
+	const auto count = allocation_count.load() - count_before;
+	const auto report = wib::measure(value);
+	REQUIRE(report.bytes == bytes);
+	REQUIRE(report.heap_blocks == count);
+}
+
+// The fast and the iterated paths of the node containers are both checked
+// against the allocations, one container per node family
+TEST_CASE("node containers with heap-free elements allocations") {
+	using it_int_t = iterated_t<int>;
+	using it_double_t = iterated_t<double>;
+	constexpr auto n = 100;
+	require_allocations_match([] {
+		auto m = std::map<int, double>{};
+		for (int i = 0; i < n; ++i) { m[i] = double(i); }
+		return m;
+	});
+	require_allocations_match([] {
+		auto m = std::map<it_int_t, it_double_t>{};
+		for (int i = 0; i < n; ++i) { m[it_int_t{ i }] = it_double_t{ double(i) }; }
+		return m;
+	});
+	require_allocations_match([] { return std::list<double>(n); });
+	require_allocations_match([] { return std::list<it_double_t>(n); });
+	require_allocations_match([] { return std::forward_list<double>(n); });
+	require_allocations_match([] { return std::forward_list<it_double_t>(n); });
+	require_allocations_match([] {
+		auto m = std::unordered_map<int, int>(4 * n);
+		for (int i = 0; i < n; ++i) { m[i] = i; }
+		return m;
+	});
+	require_allocations_match([] {
+		auto m = std::unordered_map<it_int_t, it_int_t, iterated_hash_t>(4 * n);
+		for (int i = 0; i < n; ++i) { m[it_int_t{ i }] = it_int_t{ i }; }
+		return m;
+	});
+}
+
+TEST_CASE("node container layouts") {
+	constexpr auto n = 20;
+	require_allocations_match([] {
+		auto m = std::map<int, double>{};
+		for (int i = 0; i < n; ++i) { m[i] = i; }
+		return m;
+	});
+	require_allocations_match([] {
+		auto m = std::multimap<std::string, char>{};
+		for (int i = 0; i < n; ++i) { m.emplace("key", char(i)); }
+		return m;
+	});
+	require_allocations_match([] {
+		auto s = std::set<char>{};
+		for (int i = 0; i < n; ++i) { s.insert(char(i)); }
+		return s;
+	});
+	require_allocations_match([] {
+		auto s = std::multiset<long double>{};
+		for (int i = 0; i < n; ++i) { s.insert(1.0L); }
+		return s;
+	});
+	require_allocations_match([] { return std::list<int>(n); });
+	require_allocations_match([] { return std::forward_list<double>(n); });
+	require_allocations_match([] { return std::unordered_map<int, int>{}; });
+	require_allocations_match([] {
+		auto m = std::unordered_map<int, int>(4 * n);
+		for (int i = 0; i < n; ++i) { m[i] = i; }
+		return m;
+	});
+	// Hash codes of std::string are cached by libstdc++
+	require_allocations_match([] {
+		auto m = std::unordered_multimap<std::string, int>(4 * n);
+		for (int i = 0; i < n; ++i) { m.emplace(std::to_string(i), i); }
+		return m;
+	});
+	require_allocations_match([] {
+		auto s = std::unordered_set<long double>(4 * n);
+		for (int i = 0; i < n; ++i) { s.insert(i); }
+		return s;
+	});
+	require_allocations_match([] {
+		auto s = std::unordered_multiset<short>(4 * n);
+		for (int i = 0; i < n; ++i) { s.insert(short(i % 3)); }
+		return s;
+	});
+	// Hash codes are cached for hashers which may throw
+	require_allocations_match([] {
+		auto s = std::unordered_set<int, throwing_hash_t>(4 * n);
+		for (int i = 0; i < n; ++i) { s.insert(i); }
+		return s;
+	});
+	require_allocations_match([] {
+		auto s = std::unordered_set<std::optional<std::string>>(4 * n);
+		for (int i = 0; i < n; ++i) { s.insert(std::to_string(i)); }
+		return s;
+	});
+}
+
+#ifdef __GLIBCXX__
+TEST_CASE("std::deque chunks and map") {
+	require_allocations_match([] { return std::deque<int>{}; });
+	require_allocations_match([] { return std::deque<int>(1000); });
+	require_allocations_match([] { return std::deque<std::array<char, 600>>(3); });
+	require_allocations_match([] { return std::deque<std::string>(200, std::string(5, 'a')); });
+	// Filled at the front the first element ends a new chunk
+	require_allocations_match([] { auto d = std::deque<int>{}; d.push_front(1); return d; });
+	require_allocations_match([] { auto d = std::deque<int>{}; for (int i = 0; i < 10; ++i) { d.push_front(i); } return d; });
+	require_allocations_match([] { auto d = std::deque<int>{}; for (int i = 0; i < 200; ++i) { d.push_front(i); } return d; });
+	// Growing at the front allocates whole chunks
+	auto d = std::deque<double>(64);
+	const auto bytes = wib::weight_in_bytes(d);
+	d.push_front(1.0);
+	REQUIRE(wib::weight_in_bytes(d) == bytes + 512);
+	// Chunks of grown and drained queues are exact, the map keeps its largest
+	// size which is not visible and is counted as for a constructed deque
+	{
+		// malloc_usable_size() of a fresh block, a reused free chunk may be up
+		// to 32 bytes larger when glibc does not split it
+		constexpr auto usable_bytes = [](size_t requested_bytes) -> size_t {
+			auto* ptr = std::malloc(requested_bytes);
+			const auto usable = ::malloc_usable_size(ptr);
+			std::free(ptr);
+			return usable;
+		};
+		const auto require_missing = [](size_t live_bytes, const wib::report_t& report, size_t missing_bytes) {
+			REQUIRE(report.bytes + missing_bytes <= live_bytes);
+			REQUIRE(live_bytes < report.bytes + missing_bytes + 32 * report.heap_blocks);
+		};
+		auto options = wib::options_t{};
+		options.allocator_model = usable_bytes;
+		const auto map_bytes = [usable_bytes](size_t slots) { return usable_bytes(slots * sizeof(void*)); };
+		const auto live_before = live_heap_bytes.load();
+		auto queue = std::deque<int>{};
+		for (int i = 0; i < 100'000; ++i) { queue.push_back(i); }
+		const auto grown = wib::measure(queue, options);
+		REQUIRE(grown.heap_blocks == 782 + 1);
+		// libstdc++ grows the map from 8 slots to 18, 38, ... 1278
+		require_missing(live_heap_bytes.load() - live_before, grown, map_bytes(1278) - map_bytes(784));
+		while (queue.size() > 10) { queue.pop_front(); }
+		const auto drained = wib::measure(queue, options);
+		REQUIRE(drained.heap_blocks == 1 + 1);
+		require_missing(live_heap_bytes.load() - live_before, drained, map_bytes(1278) - map_bytes(8));
+		// A short queue cycling through its chunks keeps the initial map
+		const auto fifo_before = live_heap_bytes.load();
+		auto fifo = std::deque<int>{};
+		for (int i = 0; i < 100'000; ++i) {
+			fifo.push_back(i);
+			if (fifo.size() > 10) { fifo.pop_front(); }
+		}
+		require_missing(live_heap_bytes.load() - fifo_before, wib::measure(fifo, options), 0);
+	}
+	// Unused chunk space is not reclaimable and hence not slack
+	REQUIRE(wib::slack_report(d).by_path.empty());
+	REQUIRE(wib::slack_report(d).slack_bytes == 0);
+	// Elements owning heap memory are visited
+	auto strings = std::deque<bytevec_t>(3);
+	const auto empty_bytes = wib::weight_in_bytes(strings);
+	strings[1].resize(100);
+	REQUIRE(wib::weight_in_bytes(strings) == empty_bytes + 100);
+}
+#endif
+
+TEST_CASE("std::shared_ptr control blocks") {
+	require_allocations_match([] { return std::make_shared<std::array<char, 40>>(); });
+	require_allocations_match([] { return std::shared_ptr<double>(new double{}); });
+	// Shared control blocks are counted once
+	require_allocations_match([] {
+		const auto inline_block = std::make_shared<int>(1);
+		const auto separate_block = std::shared_ptr<int>(new int{ 2 });
+		auto v = std::vector<std::shared_ptr<int>>{};
+		v.reserve(6);
+		v.insert(v.end(), 3, inline_block);
+		v.insert(v.end(), 3, separate_block);
+		return v;
+	});
+	// The most derived object starts the inline block
+	struct base_t {
+		virtual ~base_t() = default;
+		double value{};
+	};
+	struct derived_t : base_t {};
+	require_allocations_match([]() -> std::shared_ptr<base_t> { return std::make_shared<derived_t>(); });
+	// A deleter hides the layout of the control block, the object is still
+	// counted
+	struct big_t {
+		std::array<char, 64> bytes{};
+	};
+	const auto with_deleter = std::shared_ptr<big_t>(new big_t{}, +[](big_t* ptr) { delete ptr; });
+	const auto with_deleter_report = wib::measure(with_deleter);
+	REQUIRE(with_deleter_report.bytes == sizeof(big_t));
+	REQUIRE(with_deleter_report.heap_blocks == 1);
+	const auto copies = std::vector<std::shared_ptr<big_t>>(3, with_deleter);
+	REQUIRE(wib::weight_in_bytes(copies) == copies.capacity() * sizeof(with_deleter) + sizeof(big_t));
+	// A larger derived object is sized as the base, as for std::unique_ptr
+	struct large_derived_t : base_t {
+		std::array<char, 64> extra{};
+	};
+	const auto large = std::shared_ptr<base_t>{ std::make_shared<large_derived_t>() };
+	const auto large_report = wib::measure(large);
+	REQUIRE(large_report.bytes == wib::make_shared_bytes_v<base_t>);
+	REQUIRE(large_report.heap_blocks == 1);
+	REQUIRE(large_report.unknown_types == wib::measure(std::unique_ptr<base_t>{ new large_derived_t{} }).unknown_types);
+	REQUIRE(wib::weight_in_bytes(std::make_shared<large_derived_t>()) == wib::make_shared_bytes_v<large_derived_t>);
+}
+
+TEST_CASE("std::shared_ptr aliasing") {
+	struct owner_t {
+		auto as_tuple() const { return std::tie(id, count, values); }
+		int id{};
+		int count{};
+		std::vector<int> values = std::vector<int>(100);
+	};
+	using values_ptr_t = std::shared_ptr<std::vector<int>>;
+	using count_ptr_t = std::shared_ptr<int>;
+	// Aliasing pointers share the control block of the owner
+	require_allocations_match([] {
+		const auto owner = std::make_shared<owner_t>();
+		return std::make_tuple(owner, values_ptr_t(owner, &owner->values), count_ptr_t(owner, &owner->count));
+	});
+	require_allocations_match([] {
+		const auto owner = std::shared_ptr<owner_t>(new owner_t{});
+		return std::make_tuple(owner, values_ptr_t(owner, &owner->values), count_ptr_t(owner, &owner->count));
+	});
+	// Visited before the owner, an aliasing pointer does not hide the owner
+	const auto owner = std::make_shared<owner_t>();
+	const auto owner_bytes = wib::weight_in_bytes(owner);
+	const auto alias_first = std::make_tuple(count_ptr_t(owner, &owner->count), owner);
+	REQUIRE(wib::weight_in_bytes(alias_first) >= owner_bytes);
+	auto iterative = wib::options_t{};
+	iterative.traversal = wib::etraversal::Iterative;
+	REQUIRE(wib::weight_in_bytes(alias_first, iterative) >= owner_bytes);
+	// Without the owner the pointees are counted as separate objects
+	const auto values_bytes = owner->values.capacity() * sizeof(int);
+	const auto aliases = std::vector<values_ptr_t>(3, values_ptr_t(owner, &owner->values));
+	const auto aliases_report = wib::measure(aliases);
+	REQUIRE(aliases_report.bytes == aliases.capacity() * sizeof(values_ptr_t) + sizeof(std::vector<int>) + values_bytes);
+	REQUIRE(aliases_report.heap_blocks == 3);
+}
+#endif
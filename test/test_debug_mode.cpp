@@ -0,0 +1,48 @@
+
+// Built as a separate executable with the checked containers of libstdc++,
+// whose layout differs from the release containers hence both modes cannot
+// be linked into the same program
+#define _GLIBCXX_DEBUG
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "../wib/wib.hpp"
+
+#include <array>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+
+TEST_CASE("debug mode containers") {
+	REQUIRE(wib::weight_in_bytes(std::vector<int>(10)) == 10 * sizeof(int));
+	REQUIRE(wib::weight_in_bytes(std::string(100, 'a')) >= 100);
+	const auto m = std::map<int, int>{ { 1, 1 }, { 2, 2 }, { 3, 3 } };
+	REQUIRE(wib::weight_in_bytes(m) == 3 * wib::node_bytes_v<std::map<int, int>>);
+	const auto u = std::unordered_map<int, int>{ { 1, 1 }, { 2, 2 } };
+	REQUIRE(wib::weight_in_bytes(u) >= 2 * wib::node_bytes_v<std::unordered_map<int, int>>);
+	const auto shared = std::make_shared<std::vector<int>>(10);
+	REQUIRE(wib::weight_in_bytes(shared) == wib::make_shared_bytes_v<std::vector<int>> + 10 * sizeof(int));
+}
+
+#ifdef __GLIBCXX__
+TEST_CASE("debug mode std::deque") {
+	// 512 byte chunks, one spare chunk at the end and a map of at least 8 slots
+	REQUIRE(wib::weight_in_bytes(std::deque<int>{}) == 512 + 8 * sizeof(void*));
+	REQUIRE(wib::weight_in_bytes(std::deque<int>(1000)) == 8 * 512 + 10 * sizeof(void*));
+	REQUIRE(wib::weight_in_bytes(std::deque<std::array<char, 600>>(3)) == 4 * 600 + 8 * sizeof(void*));
+	auto front = std::deque<int>{};
+	front.push_front(1);
+	REQUIRE(wib::weight_in_bytes(front) == 2 * 512 + 8 * sizeof(void*));
+	auto strings = std::deque<std::string>(3);
+	const auto empty_bytes = wib::weight_in_bytes(strings);
+	strings[1].assign(100, 'a');
+	REQUIRE(wib::weight_in_bytes(strings) == empty_bytes + wib::weight_in_bytes(strings[1]));
+	REQUIRE(wib::slack_report(strings).by_path.count("[*]") == 1);
+	REQUIRE(wib::slack_report(std::deque<int>(1000)).by_path.empty());
+}
+#endif
@@ -0,0 +1,67 @@
+
+// Built as a separate executable, WIB_PARALLEL_ENABLED and WIB_STATS_ENABLED
+// changes the layout of the public structs hence both configurations cannot
+// be linked into the same program
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "../wib/wib.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <type_traits>
+
+
+
+namespace {
+template <typename T> using stats_t = decltype(std::declval<T&>().stats);
+template <typename T> using probes_t = decltype(std::declval<T&>().probes());
+static_assert(!wib::detail::type_traits::introspection::detect<wib::report_t, stats_t>::value);
+static_assert(!wib::detail::type_traits::introspection::detect<wib::detail::data_t, stats_t>::value);
+static_assert(!wib::detail::type_traits::introspection::detect<wib::detail::address_set_t, probes_t>::value);
+
+struct document_t {
+	auto as_tuple() const { return std::tie(title, body, shared); }
+	std::string title{};
+	std::vector<char> body{};
+	std::shared_ptr<std::vector<int>> shared{};
+};
+}
+
+TEST_CASE("default configuration") {
+	auto shared = std::make_shared<std::vector<int>>(10);
+	auto documents = std::vector<document_t>(3);
+	for (auto& document : documents) {
+		document.title.assign(40, 't');
+		document.body.resize(100);
+		document.shared = shared;
+	}
+	const auto expected =
+		documents.capacity() * sizeof(document_t) +
+		3 * (documents[0].title.capacity() + documents[0].body.capacity()) +
+		wib::make_shared_bytes_v<std::vector<int>> + 10 * sizeof(int);
+	REQUIRE(wib::weight_in_bytes(documents) == expected);
+	auto options = wib::options_t{};
+	options.traversal = wib::etraversal::Iterative;
+	REQUIRE(wib::weight_in_bytes(documents, options) == expected);
+	const auto report = wib::measure(documents);
+	REQUIRE(report.bytes == expected);
+	REQUIRE(report.heap_blocks == 1 + 3 * 2 + 2);
+	REQUIRE(report.unknown_types.empty());
+	REQUIRE(!report.is_lower_bound());
+	auto context = wib::measurement_context_t{};
+	REQUIRE(wib::weight_in_bytes(context, documents) == expected);
+	REQUIRE(wib::measure(context, documents).bytes == expected);
+	REQUIRE(wib::exceeds(documents, expected - 1));
+	REQUIRE(wib::weight_at_most(documents, expected) == expected);
+	REQUIRE(wib::breakdown(documents).inclusive_bytes == expected);
+	REQUIRE(wib::estimate_weight(documents).bytes == static_cast<double>(expected));
+	REQUIRE(wib::slack_report(documents).by_path.count("[*].0") == 1);
+	REQUIRE(wib::top_n(documents, 1).front().bytes == documents.capacity() * sizeof(document_t));
+	auto folded = std::ostringstream{};
+	wib::write_folded_stacks(folded, wib::breakdown(documents));
+	REQUIRE(!folded.str().empty());
+}
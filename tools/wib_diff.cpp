@@ -0,0 +1,94 @@
+// wib-diff, prints the largest changes between two snapshots written by
+// wib::write_snapshot()
+//
+// Build: g++ -std=c++17 -O2 tools/wib_diff.cpp -o wib-diff
+// Usage: wib-diff before.wibsnap after.wibsnap [count]
+
+#include "../wib/wib.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+namespace {
+
+// Read-only memory mapping of a whole file
+class mapped_file_t {
+public:
+  explicit mapped_file_t(const char* path) {
+    const auto fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      auto* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = data;
+        size_ = static_cast<size_t>(st.st_size);
+      }
+    }
+    ::close(fd);
+  }
+  mapped_file_t(const mapped_file_t&) = delete;
+  mapped_file_t& operator=(const mapped_file_t&) = delete;
+  ~mapped_file_t() {
+    if (data_ != nullptr) {
+      ::munmap(data_, size_);
+    }
+  }
+  [[nodiscard]] auto data() const noexcept -> const void* { return data_; }
+  [[nodiscard]] auto size() const noexcept -> size_t { return size_; }
+private:
+  void* data_{nullptr};
+  size_t size_{0};
+};
+
+auto print_deltas(
+  const char* title,
+  const std::vector<wib::snapshot_delta_t>& deltas
+) -> void {
+  std::printf("%s\n", title);
+  std::printf("%16s %16s %16s  %s\n", "delta", "before", "after", "name");
+  for (const auto& delta : deltas) {
+    const auto name = delta.name.empty() ? std::string_view{ "(root)" } : delta.name;
+    std::printf(
+      "%+16lld %16llu %16llu  %.*s\n",
+      static_cast<long long>(delta.delta()),
+      static_cast<unsigned long long>(delta.bytes_before),
+      static_cast<unsigned long long>(delta.bytes_after),
+      static_cast<int>(name.size()),
+      name.data()
+    );
+  }
+  std::printf("\n");
+}
+
+}
+
+
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 3) {
+    std::fprintf(stderr, "Usage: %s before.wibsnap after.wibsnap [count]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const auto count = argc > 3 ? static_cast<size_t>(std::strtoull(argv[3], nullptr, 10)) : size_t{ 20 };
+  const auto before_file = mapped_file_t{ argv[1] };
+  const auto after_file = mapped_file_t{ argv[2] };
+  const auto before = wib::snapshot_view_t::from_bytes(before_file.data(), before_file.size());
+  const auto after = wib::snapshot_view_t::from_bytes(after_file.data(), after_file.size());
+  if (!before.has_value() || !after.has_value()) {
+    std::fprintf(stderr, "%s is not a snapshot of version %u\n", !before ? argv[1] : argv[2], wib::snapshot_version);
+    return EXIT_FAILURE;
+  }
+  print_deltas("Paths (exclusive bytes)", wib::diff_snapshots(before->paths(), *before, after->paths(), *after, count));
+  print_deltas("Types", wib::diff_snapshots(before->types(), *before, after->types(), *after, count));
+  return EXIT_SUCCESS;
+}
@@ -1,26 +1,558 @@
 #pragma once
 #include <typeindex>
 #include <unordered_set>
+#include <unordered_map>
+#include <map>
 #include <tuple>
 #include <cstddef> // for size_t
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <array>
+#include <typeinfo>
+#ifdef WIB_PARALLEL_ENABLED
+  #include <execution>
+#endif
 
 // Public interface
 namespace wib {
 enum class efollow_raw_pointers{False, True};
+// Recursive follows pointers by native recursion, Iterative defers every
+// pointee and the elements of every range to a heap allocated work stack,
+// hence pointer chains and container nesting of any depth can be measured
+// without exhausting the thread stack
+enum class etraversal{Recursive, Iterative};
 using typeindex_set_t = std::unordered_set<std::type_index>;
 using empty_typelist_t = std::tuple<>;
 
+// Computed counts the requested sizes, or applies options_t::allocator_model.
+// MallocUsableSize asks malloc_usable_size() for the blocks whose start is
+// known: heap buffers of std::vector and std::basic_string using
+// std::allocator, and std::unique_ptr pointees using std::default_delete
+// whose type has no class-specific operator new.
+// Other blocks are computed, and so are all blocks unless glibc is used.
+enum class eblock_sizes{Computed, MallocUsableSize};
+
+// Maps the requested size of a heap allocation to the bytes it occupies in
+// the allocator, such as chunk headers and size-class rounding
+using allocator_model_t = size_t(*)(size_t requested_bytes);
+
+// glibc ptmalloc on 64-bit: 8 byte size header, 16 byte alignment, 32 byte
+// minimum chunk, and page granular chunks with a 16 byte header above the
+// default mmap threshold of 128 KiB
+[[nodiscard]] auto glibc_allocator_model(size_t requested_bytes) noexcept -> size_t;
+// jemalloc size classes: 8, 16 byte steps up to 128, then four classes per
+// doubling (160, 192, 224, 256, 320, ...)
+[[nodiscard]] auto jemalloc_allocator_model(size_t requested_bytes) noexcept -> size_t;
+// tcmalloc size classes for 8 KiB pages up to 256 KiB, larger allocations
+// are rounded up to whole pages
+[[nodiscard]] auto tcmalloc_allocator_model(size_t requested_bytes) noexcept -> size_t;
+
+struct options_t {
+  efollow_raw_pointers follow_raw_pointers{efollow_raw_pointers::False};
+  etraversal traversal{etraversal::Recursive};
+  // Members, elements and pointees nested deeper than max_depth are not
+  // visited, the root object is at depth 0
+  size_t max_depth{std::numeric_limits<size_t>::max()};
+  // Number of threads used by the std::execution policy overloads, 0 means
+  // std::thread::hardware_concurrency()
+  size_t max_threads{0};
+  // Ranges are only split if each thread gets at least this many elements,
+  // smaller ranges are measured by the calling thread
+  size_t min_elements_per_thread{4096};
+  // The traversal stops as soon as more bytes than byte_limit are counted
+  size_t byte_limit{std::numeric_limits<size_t>::max()};
+  // The traversal stops when more than node_budget objects (members, elements
+  // and pointees) are visited, or when the deadline has passed. The clock is
+  // only read every 256 visited objects.
+  size_t node_budget{std::numeric_limits<size_t>::max()};
+  std::optional<std::chrono::steady_clock::time_point> deadline{};
+  // Applied to every heap block, nullptr counts the requested sizes
+  allocator_model_t allocator_model{nullptr};
+  eblock_sizes block_sizes{eblock_sizes::Computed};
+};
+
+// Random picks sample elements uniformly from the whole range, Stratified
+// splits the range into equally sized strata and picks one element from each
+enum class esampling{Random, Stratified};
+
+struct sample_options_t {
+  // Number of elements measured in every range which has more elements
+  size_t sample_size{64};
+  esampling method{esampling::Stratified};
+  // Confidence level of the estimate_t interval
+  double confidence{0.95};
+  uint64_t seed{0};
+  // Ranges without random access are sampled from their first
+  // prefix_factor * sample_size elements, so that stepping to the samples
+  // costs in proportion to the sample size
+  size_t prefix_factor{16};
+};
+
+struct estimate_t {
+  double bytes{};
+  double standard_error{};
+  // Confidence interval of bytes
+  double lower_bound{};
+  double upper_bound{};
+  // True if a range was sampled from a prefix only. The elements past it are
+  // assumed to be alike, which the interval does not account for.
+  bool is_prefix_sampled{};
+};
+
+#ifdef WIB_STATS_ENABLED
+// Cost of a measurement, compiled out unless WIB_STATS_ENABLED is defined
+struct traversal_stats_t {
+  size_t nodes_visited{};
+  // Pointers whose pointee was already handled
+  size_t pointers_deduplicated{};
+  // Slots inspected when inserting into the address set, and its size after
+  // the measurement (the set only grows during a measurement). The shared
+  // set of the std::execution policy overloads is not inspected.
+  size_t address_set_probes{};
+  size_t address_set_peak_size{};
+  // Deepest nesting reached, the root object is at depth 0
+  size_t max_depth_reached{};
+  // Ranges whose elements were visited, versus ranges skipped as their
+  // elements cannot own heap memory
+  size_t ranges_walked{};
+  size_t ranges_short_circuited{};
+  std::chrono::nanoseconds wall_time{};
+};
+#endif
+
+struct report_t {
+  size_t bytes{};
+  // Number of distinct heap allocations, such as container buffers, container
+  // nodes and pointees
+  size_t heap_blocks{};
+  typeindex_set_t unknown_types{};
+  // True if parts of the object graph exceeded options_t::max_depth
+  bool depth_truncated{};
+  // True if the traversal stopped as options_t::byte_limit was exceeded, bytes
+  // is then the amount counted until that point
+  bool limit_exceeded{};
+  // True if the traversal stopped at options_t::deadline or node_budget
+  bool deadline_reached{};
+  bool node_budget_exhausted{};
+  // Number of objects (members, elements and pointees) visited, at most
+  // options_t::node_budget
+  size_t nodes_visited{};
+#ifdef WIB_STATS_ENABLED
+  traversal_stats_t stats{};
+#endif
+  // True if parts of the object graph was not visited, bytes is then a lower
+  // bound of the weight
+  [[nodiscard]] auto is_lower_bound() const noexcept -> bool {
+    return depth_truncated || limit_exceeded || deadline_reached || node_budget_exhausted;
+  }
+};
+
 template <typename AnyTypeList = empty_typelist_t, typename T>
 [[nodiscard]] auto weight_in_bytes(
   const T& value,
   efollow_raw_pointers follow_raw_pointers = efollow_raw_pointers::False
 )->size_t;
 
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto weight_in_bytes(
+  const T& value,
+  const options_t& options
+)->size_t;
+
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto measure(
+  const T& value,
+  const options_t& options = options_t{}
+)->report_t;
+
+// Budget checks, the traversal stops as soon as limit is exceeded
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto exceeds(
+  const T& value,
+  size_t limit,
+  const options_t& options = options_t{}
+)->bool;
+
+// Returns the weight if it is not larger than limit
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto weight_at_most(
+  const T& value,
+  size_t limit,
+  const options_t& options = options_t{}
+)->std::optional<size_t>;
+
+// Measures until the deadline has passed, see report_t::is_lower_bound()
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto measure_until(
+  const T& value,
+  std::chrono::steady_clock::time_point deadline,
+  const options_t& options = options_t{}
+)->report_t;
+
 template <typename AnyTypeList = empty_typelist_t, typename T>
 [[nodiscard]] auto unknown_types(
   const T& value,
   efollow_raw_pointers follow_raw_pointers = efollow_raw_pointers::False
 )->typeindex_set_t;
+
+// Measurement overloads reusing the buffers of a context
+struct measurement_context_t;
+
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto weight_in_bytes(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options = options_t{}
+)->size_t;
+
+// The returned set is owned by the context and cleared by its next measurement
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto unknown_types(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options = options_t{}
+)->const typeindex_set_t&;
+
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto measure(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options = options_t{}
+)->report_t;
+
+// A step of the path from the measured object to a member or element
+enum class esegment{Member, Element};
+struct segment_t {
+  esegment kind{};
+  // Reflected name of a member, empty if not available
+  std::string_view name{};
+  // Index of the member or element
+  size_t index{};
+};
+
+// Heap blocks owned by an object, count is 0 for bytes reported by a custom
+// weight_in_bytes()
+struct block_t {
+  size_t count{};
+  size_t bytes{};
+  // The container, pointee or custom type owning the blocks
+  const std::type_info* type{};
+  // Set for the buffer of a container with capacity(), used_bytes is then
+  // the part holding size() elements and capacity_bytes the requested size,
+  // bytes also includes the rounding of options_t::allocator_model
+  bool has_capacity{};
+  size_t used_bytes{};
+  size_t capacity_bytes{};
+  // Address returned by the allocator, nullptr if unknown or count > 1
+  const void* address{};
+};
+
+// Walks value as weight_in_bytes() and calls the hooks provided by visitor,
+// every hook is optional:
+//   enter(const segment_t&), leave()         members and elements
+//   object(const std::type_info&)            every visited object
+//   block(const block_t&)                    heap blocks owned by the current object
+//   pointer(const void*, const std::type_info&, bool is_first_visit)
+//   unknown_type(const std::type_info&)
+// With etraversal::Iterative pointees and elements are measured after the
+// object holding them, visitors following the path must then also provide
+// size_t position() and restore(size_t) to save and restore it. Otherwise
+// the traversal is recursive.
+template <typename AnyTypeList = empty_typelist_t, typename T, typename Visitor>
+auto visit(
+  const T& value,
+  Visitor& visitor,
+  const options_t& options = options_t{}
+)->report_t;
+
+// Buffers of containers with capacity(), such as std::vector and std::string
+struct slack_t {
+  // size() * sizeof(value_type)
+  size_t used_bytes{};
+  // (capacity() - size()) * sizeof(value_type)
+  size_t slack_bytes{};
+  // Bytes added by options_t::allocator_model or malloc_usable_size() on top
+  // of capacity() * sizeof(value_type), not reclaimed by shrink_to_fit()
+  size_t rounding_bytes{};
+  // Number of heap allocated buffers
+  size_t containers{};
+};
+
+// Node of the tree returned by breakdown(). Ranges whose elements cannot
+// own heap memory are measured without visiting the elements, hence such
+// ranges have no "[*]" child. A path reaching the member of an ancestor
+// again with the same type, such as the next_ of a linked list, is folded
+// into the ancestor, which then holds the bytes of every level.
+struct breakdown_node_t {
+  // Reflected member name, member index if no name is available, or "[*]"
+  // for the elements of ranges, which are collapsed into a single node
+  std::string name{};
+  // Bytes of the heap blocks owned directly by the objects at this path
+  size_t exclusive_bytes{};
+  // Bytes owned by the objects at this path and everything below them
+  size_t inclusive_bytes{};
+  size_t heap_blocks{};
+  // Number of objects visited at this path
+  size_t count{};
+  // Buffers owned directly by the objects at this path
+  slack_t slack{};
+  std::vector<breakdown_node_t> children{};
+};
+
+// Attributes the weight to member paths, such as citizens_[*].name_
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto breakdown(
+  const T& value,
+  const options_t& options = options_t{}
+)->breakdown_node_t;
+
+// Calls f(path, node) for every node of a breakdown, parents before children
+template <typename F>
+auto for_each_path(
+  const breakdown_node_t& root,
+  F&& f
+)->void;
+
+// Writes a breakdown as folded stacks for flamegraph tools, one line per
+// path owning heap blocks, such as "root;citizens_;[*];name_ 123456". The
+// value of a line is the exclusive bytes of the path.
+auto write_folded_stacks(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  std::string_view root_name = "root"
+)->void;
+
+// Writes a breakdown as an uncompressed pprof profile.proto, with paths as
+// stacks and heap blocks and bytes as the sample values inuse_objects and
+// inuse_space
+auto write_pprof(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  std::string_view root_name = "root"
+)->void;
+
+// Measures value and writes the paths while they are traversed, without
+// building a breakdown. Paths are folded as by breakdown(). A path visited
+// again later, such as the elements of a range interleaved with their
+// members, is written on another line, which flamegraph tools and pprof add
+// up.
+template <typename AnyTypeList = empty_typelist_t, typename T>
+auto write_folded_stacks(
+  std::ostream& os,
+  const T& value,
+  std::string_view root_name = "root",
+  const options_t& options = options_t{}
+)->std::enable_if_t<!std::is_same_v<T, breakdown_node_t>>;
+
+template <typename AnyTypeList = empty_typelist_t, typename T>
+auto write_pprof(
+  std::ostream& os,
+  const T& value,
+  std::string_view root_name = "root",
+  const options_t& options = options_t{}
+)->std::enable_if_t<!std::is_same_v<T, breakdown_node_t>>;
+
+struct type_weight_t {
+  // Bytes of the heap blocks owned directly by objects of the type, such as
+  // the buffers of std::strings or the pointees of std::shared_ptr<Node>
+  // attributed to Node
+  size_t bytes{};
+  // Number of visited objects of the type, objects which cannot own heap
+  // memory are not visited
+  size_t instances{};
+  size_t heap_blocks{};
+};
+using type_weights_t = std::unordered_map<std::type_index, type_weight_t>;
+
+// Attributes the weight to the types owning the heap blocks
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto weight_by_type(
+  const T& value,
+  const options_t& options = options_t{}
+)->type_weights_t;
+
+// Binary snapshot of a breakdown and the weight by type, meant to be
+// compared offline with diff_snapshots() or the wib-diff tool. A snapshot is
+// a header followed by fixed size records and a blob of names, all fields in
+// native byte order. Records are sorted by (hash, name) so that two
+// snapshots can be joined in a single pass directly on the mapped files.
+inline constexpr auto snapshot_version = uint32_t{ 1 };
+
+struct snapshot_header_t {
+  std::array<char, 8> magic{ { 'W', 'I', 'B', 'S', 'N', 'A', 'P', '\0' } };
+  uint32_t version{ snapshot_version };
+  uint32_t byte_order{ 0x01020304 };
+  uint64_t path_count{};
+  uint64_t type_count{};
+  // Offset of the path records, which are followed by the type records
+  uint64_t records_offset{};
+  uint64_t names_offset{};
+  uint64_t names_size{};
+};
+
+struct snapshot_record_t {
+  // FNV-1a of the name
+  uint64_t hash{};
+  uint64_t name_offset{};
+  uint64_t name_size{};
+  // Exclusive bytes for paths
+  uint64_t bytes{};
+  uint64_t inclusive_bytes{};
+  // Visited objects of the path, instances of the type
+  uint64_t count{};
+  uint64_t heap_blocks{};
+};
+
+struct snapshot_records_t {
+  const snapshot_record_t* first{};
+  const snapshot_record_t* last{};
+  [[nodiscard]] auto begin() const noexcept { return first; }
+  [[nodiscard]] auto end() const noexcept { return last; }
+  [[nodiscard]] auto size() const noexcept -> size_t { return static_cast<size_t>(last - first); }
+};
+
+// Zero-copy view of a snapshot, such as a memory mapped file
+class snapshot_view_t {
+public:
+  // Returns std::nullopt unless data is a snapshot of this version and byte
+  // order, which is 8-byte aligned
+  [[nodiscard]] static auto from_bytes(const void* data, size_t size)->std::optional<snapshot_view_t>;
+  [[nodiscard]] auto paths() const noexcept -> snapshot_records_t { return paths_; }
+  [[nodiscard]] auto types() const noexcept -> snapshot_records_t { return types_; }
+  // Paths are named as in for_each_path(), types by std::type_info::name()
+  [[nodiscard]] auto name(const snapshot_record_t& record) const noexcept -> std::string_view;
+private:
+  snapshot_records_t paths_{};
+  snapshot_records_t types_{};
+  std::string_view names_{};
+};
+
+auto write_snapshot(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  const type_weights_t& type_weights
+)->void;
+
+struct snapshot_delta_t {
+  // Points into the snapshot it was found in
+  std::string_view name{};
+  uint64_t bytes_before{};
+  uint64_t bytes_after{};
+  uint64_t count_before{};
+  uint64_t count_after{};
+  [[nodiscard]] auto delta() const noexcept -> int64_t {
+    return static_cast<int64_t>(bytes_after) - static_cast<int64_t>(bytes_before);
+  }
+};
+
+// The n records with the largest absolute change of bytes, largest first
+[[nodiscard]] auto diff_snapshots(
+  snapshot_records_t before,
+  const snapshot_view_t& before_view,
+  snapshot_records_t after,
+  const snapshot_view_t& after_view,
+  size_t n
+)->std::vector<snapshot_delta_t>;
+
+struct slack_report_t {
+  size_t used_bytes{};
+  size_t slack_bytes{};
+  size_t rounding_bytes{};
+  // Paths as in breakdown(), only paths owning buffers are listed
+  std::map<std::string, slack_t> by_path{};
+  std::unordered_map<std::type_index, slack_t> by_type{};
+};
+
+// Reports the unused capacity of containers, such as vectors which have been
+// cleared but keep their allocation
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto slack_report(
+  const T& value,
+  const options_t& options = options_t{}
+)->slack_report_t;
+
+// Calls shrink_to_fit() on every reachable container with capacity() whose
+// unused capacity is at least min_slack_bytes, returns the bytes reclaimed.
+// Members are reached by the same reflection as weight_in_bytes(), except
+// that raw pointers, pointers to const, keys of associative containers and
+// types with a custom weight_in_bytes() are left untouched.
+template <typename AnyTypeList = empty_typelist_t, typename T>
+auto shrink_to_fit_all(
+  T& value,
+  size_t min_slack_bytes = 0
+)->size_t;
+
+// Heap blocks grouped by size class, class i holds the blocks larger than
+// upper_bounds[i - 1] and not larger than upper_bounds[i]
+struct size_histogram_t {
+  std::vector<size_t> upper_bounds{};
+  std::vector<size_t> blocks{};
+  std::vector<size_t> bytes{};
+  // Bytes reported by custom weight_in_bytes(), which are not split into blocks
+  size_t opaque_bytes{};
+};
+
+// Histogram of the sizes of every heap block attributed to the value. Sizes
+// are grouped by powers of two unless ascending size class upper bounds are
+// provided, blocks larger than the last size class get a class of their own.
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto size_histogram(
+  const T& value,
+  const std::vector<size_t>& size_classes = {},
+  const options_t& options = options_t{}
+)->size_histogram_t;
+
+struct heavy_block_t {
+  // Size of a single block
+  size_t bytes{};
+  // Member path including element indices, such as documents_[81234].body_
+  std::string path{};
+  // The container, pointee or custom type owning the block
+  std::type_index type{ typeid(void) };
+};
+
+// The n largest heap blocks, largest first. Only n blocks and the path of
+// the current object are kept during the traversal. Nodes of containers
+// measured without visiting their elements are reported at the path of the
+// container.
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto top_n(
+  const T& value,
+  size_t n,
+  const options_t& options = options_t{}
+)->std::vector<heavy_block_t>;
+
+// Estimates the weight by measuring a sample of the elements of every range
+// and extrapolating by the number of elements
+template <typename AnyTypeList = empty_typelist_t, typename T>
+[[nodiscard]] auto estimate_weight(
+  const T& value,
+  const sample_options_t& sample_options = sample_options_t{},
+  const options_t& options = options_t{}
+)->estimate_t;
+
+#ifdef WIB_PARALLEL_ENABLED
+// Ranges are split across worker threads if a parallel policy is provided
+template <typename AnyTypeList = empty_typelist_t, typename ExecutionPolicy, typename T>
+[[nodiscard]] auto weight_in_bytes(
+  ExecutionPolicy&& policy,
+  const T& value,
+  const options_t& options = options_t{}
+)->std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>, size_t>;
+
+template <typename AnyTypeList = empty_typelist_t, typename ExecutionPolicy, typename T>
+[[nodiscard]] auto measure(
+  ExecutionPolicy&& policy,
+  const T& value,
+  const options_t& options = options_t{}
+)->std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>, report_t>;
+#endif
 }
 
 
@@ -38,6 +570,16 @@ template <typename AnyTypeList = empty_typelist_t, typename T>
 #ifdef WIB_CEREAL_ENABLED
   // Do nothing
 #endif
+#ifdef __GLIBC__
+  #include <malloc.h>
+#endif
+#ifdef WIB_PARALLEL_ENABLED
+  #include <thread>
+  #include <mutex>
+  #include <atomic>
+  #include <exception>
+  #include <iterator>
+#endif
 
 #if defined(WIB_CISTA_ENABLED) && defined(WIB_PFR_ENABLED)
 namespace {
@@ -61,6 +603,20 @@ namespace {
 #include <any>
 #include <string_view>
 #include <vector>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <list>
+#include <forward_list>
+#include <deque>
+#include <unordered_map>
+#include <iterator>
+#include <random>
+#include <cmath>
 
 
 
@@ -94,6 +650,16 @@ template <typename T> constexpr auto is_smart_ptr_f(const T&) { return std::fals
 template <typename T>
 constexpr auto is_smart_ptr_v = decltype(is_smart_ptr_f(std::declval<T>()))::value;
 
+template <typename T> constexpr auto is_unique_ptr_f(const std::unique_ptr<T>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_unique_ptr_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_unique_ptr_v = decltype(is_unique_ptr_f(std::declval<T>()))::value;
+
+template <typename T> constexpr auto is_shared_ptr_f(const std::shared_ptr<T>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_shared_ptr_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_shared_ptr_v = decltype(is_shared_ptr_f(std::declval<T>()))::value;
+
 template <typename T> constexpr auto is_weak_ptr_f(const std::weak_ptr<T>&) { return std::true_type{}; }
 template <typename T> constexpr auto is_weak_ptr_f(const T&) { return std::false_type{}; }
 template <typename T>
@@ -139,6 +705,9 @@ template <typename T> constexpr auto has_end_v = introspection::detect<T, end_t>
 template<class T> using data_t = decltype(std::declval<T&>().data());
 template <typename T> constexpr auto has_data_v = introspection::detect<T, data_t>::value;
 
+template<class T> using container_size_t = decltype(std::declval<T&>().size());
+template <typename T> constexpr auto has_size_v = introspection::detect<T, container_size_t>::value;
+
 template<class T> using capacity_t = decltype(std::declval<T&>().capacity());
 template <typename T> constexpr auto has_capacity_v = introspection::detect<T, capacity_t>::value;
 
@@ -157,6 +726,64 @@ template<class T> using cereal_save_t = decltype(std::declval<const T&>().save(
 ));
 template <typename T> constexpr auto has_cereal_save_v = introspection::detect<T, cereal_save_t>::value;
 
+// cereal::NameValuePair, detected by its members to not depend on cereal
+template<class T> using nvp_name_t = decltype(std::declval<const T&>().name);
+template<class T> using nvp_value_t = decltype(std::declval<const T&>().value);
+template <typename T>
+constexpr auto is_name_value_pair_f() -> bool {
+  if constexpr (
+    introspection::detect<T, nvp_name_t>::value &&
+    introspection::detect<T, nvp_value_t>::value
+  ) {
+    return std::is_convertible_v<nvp_name_t<T>, const char*>;
+  }
+  else {
+    return false;
+  }
+}
+template <typename T>
+constexpr auto is_name_value_pair_v = is_name_value_pair_f<T>();
+
+template<class T> using shrink_to_fit_t = decltype(std::declval<T&>().shrink_to_fit());
+template <typename T> constexpr auto has_shrink_to_fit_v = introspection::detect<T, shrink_to_fit_t>::value;
+
+template <typename Tpl, size_t ...Is>
+constexpr auto tuple_of_references_f(std::index_sequence<Is...>) -> bool {
+  return (std::is_lvalue_reference_v<std::tuple_element_t<Is, Tpl>> && ...);
+}
+template <typename Tpl>
+constexpr auto is_tuple_of_references_v = tuple_of_references_f<Tpl>(std::make_index_sequence<std::tuple_size_v<Tpl>>{});
+
+// Hooks of visit()
+template<class V> using enter_hook_t = decltype(std::declval<V&>().enter(std::declval<const segment_t&>()));
+template<class V> using leave_hook_t = decltype(std::declval<V&>().leave());
+template<class V> using object_hook_t = decltype(std::declval<V&>().object(typeid(int)));
+template<class V> using block_hook_t = decltype(std::declval<V&>().block(std::declval<const block_t&>()));
+template<class V> using pointer_hook_t = decltype(std::declval<V&>().pointer(std::declval<const void*>(), typeid(int), true));
+template<class V> using unknown_type_hook_t = decltype(std::declval<V&>().unknown_type(typeid(int)));
+template<class V> using position_hook_t = decltype(std::declval<V&>().position());
+template<class V> using restore_hook_t = decltype(std::declval<V&>().restore(size_t{}));
+template <typename V>
+constexpr auto has_path_hooks_v =
+  introspection::detect<V, position_hook_t>::value &&
+  introspection::detect<V, restore_hook_t>::value;
+
+// std::vector and std::basic_string using std::allocator, whose buffers are
+// allocated by operator new unless stored inside the string
+template <typename T> constexpr auto is_std_allocated_buffer_f(const std::vector<T, std::allocator<T>>&) { return std::true_type{}; }
+template <typename C, typename Tr> constexpr auto is_std_allocated_buffer_f(const std::basic_string<C, Tr, std::allocator<C>>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_std_allocated_buffer_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_std_allocated_buffer_v = decltype(is_std_allocated_buffer_f(std::declval<T>()))::value;
+
+// Class-specific operator new, such as a pool or an arena, allocates blocks
+// which are not known to malloc
+template <class T> using member_operator_new_t = decltype(T::operator new(std::declval<size_t>()));
+template <class T>
+constexpr auto has_member_operator_new_v = introspection::detect<T, member_operator_new_t>::value;
+
+template <class T> using bucket_count_t = decltype(std::declval<const T&>().bucket_count());
+
 template <class T> using key_type_t = typename T::key_type;
 template <class T> using mapped_type_t = typename T::mapped_type;
 template <class T>
@@ -164,6 +791,141 @@ constexpr auto is_map_v =
   introspection::detect<T, key_type_t>::value &&
   introspection::detect<T, mapped_type_t>::value;
 
+template <typename T, size_t N> constexpr auto is_std_array_f(const std::array<T, N>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_std_array_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_std_array_v = decltype(is_std_array_f(std::declval<T>()))::value;
+
+template <typename T, typename A> constexpr auto is_deque_f(const std::deque<T, A>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_deque_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_deque_v = decltype(is_deque_f(std::declval<T>()))::value;
+
+// Standard containers storing each element in a separately allocated node
+template <typename K, typename V, typename C, typename A> constexpr auto is_node_container_f(const std::map<K, V, C, A>&) { return std::true_type{}; }
+template <typename K, typename V, typename C, typename A> constexpr auto is_node_container_f(const std::multimap<K, V, C, A>&) { return std::true_type{}; }
+template <typename K, typename C, typename A> constexpr auto is_node_container_f(const std::set<K, C, A>&) { return std::true_type{}; }
+template <typename K, typename C, typename A> constexpr auto is_node_container_f(const std::multiset<K, C, A>&) { return std::true_type{}; }
+template <typename K, typename V, typename H, typename E, typename A> constexpr auto is_node_container_f(const std::unordered_map<K, V, H, E, A>&) { return std::true_type{}; }
+template <typename K, typename V, typename H, typename E, typename A> constexpr auto is_node_container_f(const std::unordered_multimap<K, V, H, E, A>&) { return std::true_type{}; }
+template <typename K, typename H, typename E, typename A> constexpr auto is_node_container_f(const std::unordered_set<K, H, E, A>&) { return std::true_type{}; }
+template <typename K, typename H, typename E, typename A> constexpr auto is_node_container_f(const std::unordered_multiset<K, H, E, A>&) { return std::true_type{}; }
+template <typename T, typename A> constexpr auto is_node_container_f(const std::list<T, A>&) { return std::true_type{}; }
+template <typename T, typename A> constexpr auto is_node_container_f(const std::forward_list<T, A>&) { return std::true_type{}; }
+template <typename T> constexpr auto is_node_container_f(const T&) { return std::false_type{}; }
+template <typename T>
+constexpr auto is_node_container_v = decltype(is_node_container_f(std::declval<T>()))::value;
+
+template <typename T>
+using bare_t = std::remove_cv_t<std::remove_reference_t<T>>;
+
+
+// Proves that a type cannot own heap memory, the checks mirrors the
+// dispatch order of get_heap_allocated_bytes()
+template <typename T>
+constexpr auto never_allocates_f() -> bool;
+
+template <typename Tpl, size_t ...Is>
+constexpr auto tuple_never_allocates_f(std::index_sequence<Is...>) -> bool {
+  return (never_allocates_f<bare_t<std::tuple_element_t<Is, Tpl>>>() && ...);
+}
+
+template <typename Variant, size_t ...Is>
+constexpr auto variant_never_allocates_f(std::index_sequence<Is...>) -> bool {
+  return (never_allocates_f<bare_t<std::variant_alternative_t<Is, Variant>>>() && ...);
+}
+
+#if defined(WIB_PFR_ENABLED)
+template <typename T, size_t ...Is>
+constexpr auto fields_never_allocates_f(std::index_sequence<Is...>) -> bool {
+  return (never_allocates_f<bare_t<boost::pfr::tuple_element_t<Is, T>>>() && ...);
+}
+#endif
+
+template <typename T>
+constexpr auto never_allocates_f() -> bool {
+  if constexpr (
+    std::is_arithmetic_v<T> ||
+    std::is_enum_v<T> ||
+    is_string_view_v<T> ||
+    is_weak_ptr_v<T>
+  ) {
+    return true;
+  }
+  else if constexpr (has_weight_in_bytes_v<T>) {
+    return false;
+  }
+  else if constexpr (as_tuple_v<T>) {
+    return never_allocates_f<bare_t<as_tuple_t<T>>>();
+  }
+  else if constexpr (sizeof(T) < sizeof(const void*)) {
+    return true;
+  }
+  else if constexpr (is_optional_v<T>) {
+    return never_allocates_f<typename T::value_type>();
+  }
+  else if constexpr (
+    is_smart_ptr_v<T> ||
+    std::is_pointer_v<T>
+  ) {
+    return false;
+  }
+  else if constexpr (is_variant_v<T>) {
+    return variant_never_allocates_f<T>(std::make_index_sequence<std::variant_size_v<T>>{});
+  }
+  else if constexpr (is_pair_v<T>) {
+    return
+      never_allocates_f<bare_t<typename T::first_type>>() &&
+      never_allocates_f<bare_t<typename T::second_type>>();
+  }
+  else if constexpr (is_tuple_v<T>) {
+    return tuple_never_allocates_f<T>(std::make_index_sequence<std::tuple_size_v<T>>{});
+  }
+  else if constexpr (std::is_array_v<T>) {
+    return never_allocates_f<std::remove_cv_t<std::remove_all_extents_t<T>>>();
+  }
+  else if constexpr (is_std_array_v<T>) {
+    return never_allocates_f<std::remove_cv_t<typename T::value_type>>();
+  }
+  // Other containers and std::any might allocate
+  else if constexpr (
+    (has_begin_v<T> && has_end_v<T>) ||
+    is_any_v<T>
+  ) {
+    return false;
+  }
+#ifdef WIB_CEREAL_ENABLED
+  else if constexpr (
+    has_cereal_serialize_v<T> ||
+    has_cereal_save_v<T>
+  ) {
+    return false;
+  }
+#endif
+  else if constexpr (std::is_aggregate_v<T>) {
+#if defined(WIB_PFR_ENABLED)
+    return fields_never_allocates_f<T>(std::make_index_sequence<boost::pfr::tuple_size_v<T>>{});
+#elif defined(WIB_CISTA_ENABLED)
+    return never_allocates_f<bare_t<decltype(cista::to_tuple(std::declval<T&>()))>>();
+#else
+    return false;
+#endif
+  }
+  // Unknown types cannot be proven not to allocate
+  else {
+    return false;
+  }
+}
+
+}
+
+
+namespace wib {
+// True if T is statically known to never own any heap memory, such as
+// arithmetic types, enums, std::array of such types and aggregates whose
+// reflected members are all heap-free
+template <typename T>
+constexpr auto never_allocates_v = detail::type_traits::never_allocates_f<std::remove_cv_t<T>>();
 }
 
 
@@ -186,6 +948,251 @@ constexpr auto is_map_v =
 
 
 
+
+
+
+// Node layouts of the standard library containers. Each node is a separate
+// allocation holding the links of the container next to the value, hash
+// tables additionally allocate an array of bucket_count() pointers.
+namespace wib::detail::node_layout {
+
+// Storage of a value inside a node, the node does not construct it
+template <typename V>
+struct value_storage_t {
+  alignas(V) unsigned char bytes[sizeof(V)];
+};
+
+#if defined(_LIBCPP_VERSION)
+// __tree_node, __list_node, __forward_list_node and __hash_node of libc++
+template <typename V> struct tree_node_t { void* left; void* right; void* parent; bool is_black; value_storage_t<V> value; };
+template <typename V> struct list_node_t { void* prev; void* next; value_storage_t<V> value; };
+template <typename V> struct forward_list_node_t { void* next; value_storage_t<V> value; };
+template <typename K, typename V, typename H> struct hash_node_t { void* next; size_t hash; value_storage_t<V> value; };
+#elif defined(__GLIBCXX__)
+// Hashers libstdc++ considers slow, the standard hashers of strings, string
+// views and long double. Other hashers, including those of user types, are
+// considered fast.
+template <typename H> struct is_fast_hash : std::true_type {};
+template <> struct is_fast_hash<std::hash<long double>> : std::false_type {};
+template <typename C, typename Tr, typename A> struct is_fast_hash<std::hash<std::basic_string<C, Tr, A>>> : std::false_type {};
+template <typename C, typename Tr> struct is_fast_hash<std::hash<std::basic_string_view<C, Tr>>> : std::false_type {};
+template <typename T> struct is_fast_hash<std::hash<std::optional<T>>> : is_fast_hash<std::hash<T>> {};
+// _Rb_tree_node, _List_node, _Fwd_list_node and _Hash_node of libstdc++, the
+// hash code is cached unless the hasher is fast and noexcept
+template <typename V> struct tree_node_t { int color; void* parent; void* left; void* right; value_storage_t<V> value; };
+template <typename V> struct list_node_t { void* next; void* prev; value_storage_t<V> value; };
+template <typename V> struct forward_list_node_t { void* next; value_storage_t<V> value; };
+template <typename V, bool IsHashCached> struct cached_hash_node_t { void* next; value_storage_t<V> value; size_t hash; };
+template <typename V> struct cached_hash_node_t<V, false> { void* next; value_storage_t<V> value; };
+template <typename K, typename H>
+constexpr auto is_hash_cached_v = !(is_fast_hash<H>::value && std::is_nothrow_invocable_v<const H&, const K&>);
+template <typename K, typename V, typename H> struct hash_node_t : cached_hash_node_t<V, is_hash_cached_v<K, H>> {};
+#else
+// Unknown standard library, only the value is counted
+template <typename V> struct tree_node_t { value_storage_t<V> value; };
+template <typename V> struct list_node_t { value_storage_t<V> value; };
+template <typename V> struct forward_list_node_t { value_storage_t<V> value; };
+template <typename K, typename V, typename H> struct hash_node_t { value_storage_t<V> value; };
+#endif
+
+template <typename T> struct node_of_t;
+template <typename K, typename V, typename C, typename A> struct node_of_t<std::map<K, V, C, A>> { using type = tree_node_t<std::pair<const K, V>>; };
+template <typename K, typename V, typename C, typename A> struct node_of_t<std::multimap<K, V, C, A>> { using type = tree_node_t<std::pair<const K, V>>; };
+template <typename K, typename C, typename A> struct node_of_t<std::set<K, C, A>> { using type = tree_node_t<K>; };
+template <typename K, typename C, typename A> struct node_of_t<std::multiset<K, C, A>> { using type = tree_node_t<K>; };
+template <typename K, typename V, typename H, typename E, typename A> struct node_of_t<std::unordered_map<K, V, H, E, A>> { using type = hash_node_t<K, std::pair<const K, V>, H>; };
+template <typename K, typename V, typename H, typename E, typename A> struct node_of_t<std::unordered_multimap<K, V, H, E, A>> { using type = hash_node_t<K, std::pair<const K, V>, H>; };
+template <typename K, typename H, typename E, typename A> struct node_of_t<std::unordered_set<K, H, E, A>> { using type = hash_node_t<K, K, H>; };
+template <typename K, typename H, typename E, typename A> struct node_of_t<std::unordered_multiset<K, H, E, A>> { using type = hash_node_t<K, K, H>; };
+template <typename T, typename A> struct node_of_t<std::list<T, A>> { using type = list_node_t<T>; };
+template <typename T, typename A> struct node_of_t<std::forward_list<T, A>> { using type = forward_list_node_t<T>; };
+
+// Bytes of the bucket array of a hash table. libc++ allocates every bucket
+// and reports no buckets when none are allocated, libstdc++ stores a single
+// bucket inside the container.
+template <typename T>
+[[nodiscard]] auto bucket_bytes(const T& value) -> size_t {
+  if constexpr (type_traits::introspection::detect<T, type_traits::bucket_count_t>::value) {
+#if defined(_LIBCPP_VERSION)
+    return value.bucket_count() * sizeof(void*);
+#else
+    return value.bucket_count() > 1 ? value.bucket_count() * sizeof(void*) : 0;
+#endif
+  }
+  else {
+    return 0;
+  }
+}
+
+}
+
+
+// Chunks of a std::deque and the map of chunk pointers. libstdc++ allocates
+// chunks of 512 bytes, or of a single element if larger, and always holds a
+// chunk for the end position. The chunk count follows from the position of
+// the first element within its chunk, which is read from the implementation
+// details of the libstdc++ iterator, _M_cur and _M_first, unwrapping the
+// checked iterators of _GLIBCXX_DEBUG through base(). If those are not found
+// the position is estimated by comparing element addresses, which does not
+// see a partial first chunk holding all elements. The map is counted as
+// allocated by the constructor, one slot per chunk plus one at
+// each end and at least 8 slots, which is exact for constructed, copied and
+// shrunk deques. Insertions grow the map by doubling it and it never shrinks,
+// so the map of a grown or drained queue is larger than counted. Its size is
+// not visible through the public interface, and the map bytes are then a
+// lower bound (unless the chunks fill the map to within a slot of both
+// ends). libc++ allocates 4096 byte chunks and the map is estimated as one
+// slot per chunk. Other standard libraries count the elements only.
+namespace wib::detail::deque_layout {
+
+struct layout_t {
+  size_t chunk_count{};
+  size_t chunk_bytes{};
+  size_t map_slots{};
+};
+
+#if defined(__GLIBCXX__)
+template<class It> using chunk_first_t = decltype(std::declval<const It&>()._M_first);
+template<class It> using base_chunk_first_t = decltype(std::declval<const It&>().base()._M_first);
+
+// Position of the first element within its chunk
+template <typename T, typename A>
+[[nodiscard]] auto first_chunk_offset(const std::deque<T, A>& value, size_t chunk_size) -> size_t {
+  using iterator_t = typename std::deque<T, A>::const_iterator;
+  if constexpr (type_traits::introspection::detect<iterator_t, chunk_first_t>::value) {
+    const auto it = value.begin();
+    return static_cast<size_t>(it._M_cur - it._M_first);
+  }
+  else if constexpr (type_traits::introspection::detect<iterator_t, base_chunk_first_t>::value) {
+    const auto it = value.begin();
+    return static_cast<size_t>(it.base()._M_cur - it.base()._M_first);
+  }
+  else {
+    if (value.empty()) {
+      return 0;
+    }
+    const auto* first = std::addressof(value.front());
+    const auto count = std::min(value.size(), chunk_size);
+    for (size_t i = 1; i < count; ++i) {
+      if (std::addressof(value[i]) != first + i) {
+        return chunk_size - i;
+      }
+    }
+    return 0;
+  }
+}
+#endif
+
+template <typename T, typename A>
+[[nodiscard]] auto layout(const std::deque<T, A>& value) -> layout_t {
+#if defined(__GLIBCXX__)
+  constexpr auto chunk_size = sizeof(T) < 512 ? 512 / sizeof(T) : size_t{ 1 };
+  const auto chunk_count = (first_chunk_offset(value, chunk_size) + value.size()) / chunk_size + 1;
+  return layout_t{ chunk_count, chunk_size * sizeof(T), std::max(size_t{ 8 }, chunk_count + 2) };
+#elif defined(_LIBCPP_VERSION)
+  constexpr auto chunk_size = sizeof(T) < 256 ? 4096 / sizeof(T) : size_t{ 16 };
+  const auto chunk_count = (value.size() + chunk_size - 1) / chunk_size;
+  return layout_t{ chunk_count, chunk_size * sizeof(T), chunk_count };
+#else
+  return layout_t{ value.size(), sizeof(T), 0 };
+#endif
+}
+
+}
+
+
+// Control blocks of std::shared_ptr. Both libstdc++ and libc++ store the
+// pointer to the control block after the pointer to the object, and the
+// control block starts its allocation. std::make_shared() places the object
+// inside the control block, otherwise the control block holds the counters
+// and the pointer to the object. Custom deleters and allocators are assumed
+// to be empty. libc++ stores a non-empty deleter after the pointer, where it
+// enlarges the control block without being detected, while libstdc++ stores
+// it before the pointer, which then cannot be read and the std::shared_ptr
+// is not known to own its object.
+namespace wib::detail::shared_ptr_layout {
+
+#if defined(_LIBCPP_VERSION)
+// __shared_ptr_emplace and __shared_ptr_pointer of libc++
+template <typename V> struct inline_block_t { void* vptr; long shared_owners; long weak_owners; node_layout::value_storage_t<V> value; };
+struct separate_block_t { void* vptr; long shared_owners; long weak_owners; const void* pointer; };
+#elif defined(__GLIBCXX__)
+// _Sp_counted_ptr_inplace and _Sp_counted_ptr of libstdc++
+template <typename V> struct inline_block_t { void* vptr; int use_count; int weak_count; node_layout::value_storage_t<V> value; };
+struct separate_block_t { void* vptr; int use_count; int weak_count; const void* pointer; };
+#else
+// Unknown standard library, only the object is counted
+template <typename V> struct inline_block_t { node_layout::value_storage_t<V> value; };
+#endif
+
+struct control_block_t {
+  // Identifies the control block, shared by all std::shared_ptr owning the
+  // same object including aliasing ones
+  const uint8_t* address{};
+  // Bytes of the control block, if is_inline excluding the object
+  size_t bytes{};
+  bool is_inline{};
+  // True if the std::shared_ptr is known to point to the owned object. False
+  // for pointers made by the aliasing constructor, but also for owners whose
+  // control block layout is not understood, such as one with a deleter
+  bool is_owner{};
+};
+
+// Returns an empty control block if the layout is unknown
+template <typename T>
+[[nodiscard]] auto control_block(const std::shared_ptr<T>& value) -> control_block_t {
+#if defined(_LIBCPP_VERSION) || defined(__GLIBCXX__)
+  static_assert(sizeof(value) == 2 * sizeof(const void*));
+  using element_t = std::remove_cv_t<typename std::shared_ptr<T>::element_type>;
+  auto words = std::array<const uint8_t*, 2>{};
+  std::memcpy(words.data(), std::addressof(value), sizeof(value));
+  const auto address = words[1];
+  if (address == nullptr || value.get() == nullptr) {
+    return control_block_t{};
+  }
+  // The most derived object follows the counters, aligned for its type which
+  // is unknown if it differs from element_t
+  const auto* object = [&value]() -> const uint8_t* {
+    if constexpr (std::is_polymorphic_v<element_t>) {
+      return reinterpret_cast<const uint8_t*>(dynamic_cast<const void*>(value.get()));
+    }
+    else {
+      return reinterpret_cast<const uint8_t*>(value.get());
+    }
+  }();
+  constexpr auto min_offset = offsetof(inline_block_t<element_t>, value);
+  constexpr auto max_offset = std::is_polymorphic_v<element_t> ?
+    std::max(min_offset, offsetof(inline_block_t<std::max_align_t>, value)) :
+    min_offset;
+  if (object == address + min_offset) {
+    return control_block_t{ address, sizeof(inline_block_t<element_t>) - sizeof(element_t), true, true };
+  }
+  if (object > address + min_offset && object <= address + max_offset) {
+    return control_block_t{ address, static_cast<size_t>(object - address), true, true };
+  }
+  // A separate control block holds the pointer to the owned object
+  auto owned = static_cast<const void*>(nullptr);
+  std::memcpy(&owned, address + offsetof(separate_block_t, pointer), sizeof(owned));
+  const auto is_owner = owned == value.get() || owned == object;
+  return control_block_t{ address, sizeof(separate_block_t), false, is_owner };
+#else
+  return control_block_t{};
+#endif
+}
+
+}
+
+
+namespace wib {
+// Bytes of each node allocated by the standard node container T, such as
+// std::map or std::unordered_set, including the links to other nodes
+template <typename T>
+constexpr auto node_bytes_v = sizeof(typename detail::node_layout::node_of_t<std::remove_cv_t<T>>::type);
+
+// Bytes allocated by std::make_shared<T>(), the object and its control block
+template <typename T>
+constexpr auto make_shared_bytes_v = sizeof(detail::shared_ptr_layout::inline_block_t<std::remove_cv_t<T>>);
+}
 
 
 
@@ -275,52 +1282,603 @@ namespace wib::detail {
 
 
 using byteptr_t = const uint8_t*;
-using address_set_t = std::unordered_set<byteptr_t>;
 
 
-
-struct data_t {
+// Flat open addressing set of non-null addresses using linear probing.
+// Lookup and insertion is a single probe sequence, and clear() keeps the
+// allocated slots for reuse.
+class address_set_t {
+public:
+  // Returns true if the address was not already in the set
+  auto insert(byteptr_t address) -> bool {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      grow();
+    }
+    for (auto idx = slot_index(address);; idx = (idx + 1) & mask_) {
+#ifdef WIB_STATS_ENABLED
+      ++probes_;
+#endif
+      auto& slot = slots_[idx];
+      if (slot == address) {
+        return false;
+      }
+      if (slot == nullptr) {
+        slot = address;
+        ++size_;
+        return true;
+      }
+    }
+  }
+  [[nodiscard]] auto contains(byteptr_t address) const noexcept -> bool {
+    if (size_ == 0) {
+      return false;
+    }
+    for (auto idx = slot_index(address);; idx = (idx + 1) & mask_) {
+      const auto slot = slots_[idx];
+      if (slot == address) {
+        return true;
+      }
+      if (slot == nullptr) {
+        return false;
+      }
+    }
+  }
+  [[nodiscard]] auto size() const noexcept -> size_t { return size_; }
+  [[nodiscard]] auto capacity() const noexcept -> size_t { return slots_.size(); }
+#ifdef WIB_STATS_ENABLED
+  // Slots inspected by insert() since construction
+  [[nodiscard]] auto probes() const noexcept -> size_t { return probes_; }
+#endif
+  auto clear() noexcept -> void {
+    if (size_ > 0) {
+      std::fill(slots_.begin(), slots_.end(), nullptr);
+      size_ = 0;
+    }
+  }
+  auto reserve(size_t count) -> void {
+    while (count * 2 > slots_.size()) {
+      grow();
+    }
+  }
+private:
+  // Fibonacci hashing of the address with the alignment bits shifted out
+  [[nodiscard]] auto slot_index(byteptr_t address) const noexcept -> size_t {
+    const auto bits = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(address)) >> 4;
+    return static_cast<size_t>((bits * 0x9E3779B97F4A7C15ull) >> shift_);
+  }
+  auto grow() -> void {
+    const auto new_capacity = slots_.empty() ? size_t{ 16 } : slots_.size() * 2;
+    auto old_slots = std::vector<byteptr_t>(new_capacity, nullptr);
+    std::swap(old_slots, slots_);
+    mask_ = new_capacity - 1;
+    shift_ = 64;
+    for (auto c = new_capacity; c > 1; c >>= 1) {
+      --shift_;
+    }
+    size_ = 0;
+    for (const auto address : old_slots) {
+      if (address != nullptr) {
+        insert(address);
+      }
+    }
+  }
+  std::vector<byteptr_t> slots_{};
+  size_t size_{};
+  size_t mask_{};
+  unsigned shift_{ 64 };
+#ifdef WIB_STATS_ENABLED
+  size_t probes_{};
+#endif
+};
+
+
+#ifdef WIB_PARALLEL_ENABLED
+// Address set shared by worker threads, split into individually locked shards
+class concurrent_address_set_t {
+public:
+  // Returns true if the address was not already in the set
+  auto insert(byteptr_t address) -> bool {
+    const auto bits = reinterpret_cast<uintptr_t>(address) >> 4;
+    auto& shard = shards_[bits % shard_count];
+    const auto lock = std::lock_guard<std::mutex>{ shard.mutex };
+    return shard.addresses.insert(address);
+  }
+  [[nodiscard]] auto contains(byteptr_t address) -> bool {
+    const auto bits = reinterpret_cast<uintptr_t>(address) >> 4;
+    auto& shard = shards_[bits % shard_count];
+    const auto lock = std::lock_guard<std::mutex>{ shard.mutex };
+    return shard.addresses.contains(address);
+  }
+private:
+  static constexpr auto shard_count = size_t{ 64 };
+  struct alignas(64) shard_t {
+    std::mutex mutex{};
+    address_set_t addresses{};
+  };
+  std::array<shard_t, shard_count> shards_{};
+};
+
+struct parallel_t {
+  concurrent_address_set_t& shared_addresses;
+  size_t thread_count{};
+  size_t min_elements_per_thread{};
+};
+
+// Progress of the workers of a split range against the byte limit and the
+// node budget, which bound the workers together
+struct shared_budget_t {
+  std::atomic<size_t> counted_bytes{0};
+  std::atomic<size_t> nodes_visited{0};
+  // Set once any worker halts
+  std::atomic<bool> halted{false};
+};
+#endif
+
+
+
+// Follows the traversal, used by the reports attributing the weight to paths
+// and types and by visit()
+class observer_t {
+public:
+  virtual ~observer_t() = default;
+  virtual auto enter([[maybe_unused]] const segment_t& segment) -> void {}
+  virtual auto leave() -> void {}
+  // Every visited object, objects which cannot own heap memory are not visited
+  virtual auto object([[maybe_unused]] const std::type_info& type) -> void {}
+  // Blocks owned by the object at the current path
+  virtual auto block([[maybe_unused]] const block_t& block) -> void {}
+  virtual auto pointer(
+    [[maybe_unused]] const void* pointee,
+    [[maybe_unused]] const std::type_info& type,
+    [[maybe_unused]] bool is_first_visit
+  ) -> void {}
+  virtual auto unknown_type([[maybe_unused]] const std::type_info& type) -> void {}
+  // Token of the current path, restored when a deferred pointee is measured
+  [[nodiscard]] virtual auto position() -> size_t { return 0; }
+  virtual auto restore([[maybe_unused]] size_t position) -> void {}
+};
+
+
+struct data_t;
+
+// Type-erased deferred measurement used by etraversal::Iterative, either a
+// pointee or the remaining elements of a range
+struct frame_t {
+  const void* address{};
+  size_t(*measure)(const frame_t&, data_t&){};
+  size_t depth{};
+  // observer_t::position() of the pointer or range
+  size_t position{};
+  // Index of the next element of a range, and its iterator unless the range
+  // has random access
+  size_t index{};
+  std::array<const void*, 2> cursor{};
+};
+using work_stack_t = std::vector<frame_t>;
+
+
+// State of estimate_weight()
+struct sampling_t {
+  const size_t sample_size{};
+  const esampling method{};
+  const size_t prefix_factor{};
+  std::mt19937_64 rng{};
+  // Variance of the extrapolated bytes
+  double variance{};
+  bool is_prefix_sampled{false};
+};
+
+
+struct data_t {
   const efollow_raw_pointers follow_raw_pointers{};
   address_set_t& handled_addresses;
   typeindex_set_t* unknown_types{nullptr};
   size_t& current_depth;
+  const size_t max_depth{std::numeric_limits<size_t>::max()};
+  work_stack_t* work_stack{nullptr};
+  bool depth_truncated{false};
+  size_t heap_blocks{0};
+  sampling_t* sampling{nullptr};
+  size_t byte_limit{std::numeric_limits<size_t>::max()};
+  size_t counted_bytes{0};
+  bool limit_exceeded{false};
+  size_t node_budget{std::numeric_limits<size_t>::max()};
+  size_t nodes_visited{0};
+  std::optional<std::chrono::steady_clock::time_point> deadline{};
+  bool node_budget_exhausted{false};
+  bool deadline_reached{false};
+  // Set when the traversal shall stop as soon as possible
+  bool halted{false};
+  observer_t* observer{nullptr};
+  allocator_model_t allocator_model{nullptr};
+  eblock_sizes block_sizes{eblock_sizes::Computed};
+#ifdef WIB_STATS_ENABLED
+  traversal_stats_t stats{};
+#endif
+#ifdef WIB_PARALLEL_ENABLED
+  // Set for the thread which may split ranges across workers
+  const parallel_t* parallel{nullptr};
+  // Replaces handled_addresses when measuring with several threads
+  concurrent_address_set_t* shared_addresses{nullptr};
+  // Set for the workers of a split range
+  shared_budget_t* shared_budget{nullptr};
+#endif
 };
 
 
+// Stops the traversal, and the other workers of a split range
+inline auto halt(
+  data_t& io_data
+) -> void {
+  io_data.halted = true;
+#ifdef WIB_PARALLEL_ENABLED
+  if (io_data.shared_budget != nullptr) {
+    io_data.shared_budget->halted.store(true, std::memory_order_relaxed);
+  }
+#endif
+}
+
+// Reading the clock is amortised over this many visited objects
+inline constexpr auto deadline_check_interval = size_t{ 256 };
+
+// Every visited object passes through here, returns false if the traversal
+// shall stop
+[[nodiscard]] inline auto visit_node(
+  data_t& io_data
+) -> bool {
+  // The node exceeding the budget is rejected and not counted as visited
+  auto nodes_visited = io_data.nodes_visited;
+#ifdef WIB_PARALLEL_ENABLED
+  if (io_data.shared_budget != nullptr) {
+    if (io_data.shared_budget->halted.load(std::memory_order_relaxed)) {
+      io_data.halted = true;
+      return false;
+    }
+    nodes_visited = io_data.shared_budget->nodes_visited.fetch_add(1, std::memory_order_relaxed);
+  }
+#endif
+  if (nodes_visited >= io_data.node_budget) {
+    io_data.node_budget_exhausted = true;
+    halt(io_data);
+    return false;
+  }
+  ++io_data.nodes_visited;
+  if (
+    io_data.deadline.has_value() &&
+    io_data.nodes_visited % deadline_check_interval == 0 &&
+    std::chrono::steady_clock::now() >= *io_data.deadline
+  ) {
+    io_data.deadline_reached = true;
+    halt(io_data);
+  }
+  return !io_data.halted;
+}
+
+// Every byte attributed to the measured object passes through here
+[[nodiscard]] inline auto count_bytes(
+  data_t& io_data,
+  size_t bytes
+) -> size_t {
+  io_data.counted_bytes += bytes;
+  auto counted_bytes = io_data.counted_bytes;
+#ifdef WIB_PARALLEL_ENABLED
+  if (io_data.shared_budget != nullptr) {
+    counted_bytes = io_data.shared_budget->counted_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  }
+#endif
+  if (counted_bytes > io_data.byte_limit) {
+    io_data.limit_exceeded = true;
+    halt(io_data);
+  }
+  return bytes;
+}
+
+// Registers heap blocks owned by the measured object, returns their total size
+[[nodiscard]] inline auto add_block(
+  data_t& io_data,
+  const block_t& block
+) -> size_t {
+  io_data.heap_blocks += block.count;
+  if (io_data.observer != nullptr) {
+    io_data.observer->block(block);
+  }
+  return count_bytes(io_data, block.bytes);
+}
+
+// Bytes occupied by a heap allocation of the requested size. The allocator
+// is asked if the start of the block is known and options_t::block_sizes
+// says so, a malloc block is never smaller than requested hence smaller
+// answers are discarded.
+[[nodiscard]] inline auto footprint(
+  const data_t& io_data,
+  size_t requested_bytes,
+  [[maybe_unused]] const void* block_start = nullptr
+) -> size_t {
+#ifdef __GLIBC__
+  if (block_start != nullptr && io_data.block_sizes == eblock_sizes::MallocUsableSize) {
+    const auto usable_bytes = ::malloc_usable_size(const_cast<void*>(block_start));
+    if (usable_bytes >= requested_bytes) {
+      return usable_bytes;
+    }
+  }
+#endif
+  return io_data.allocator_model != nullptr ?
+    io_data.allocator_model(requested_bytes) :
+    requested_bytes;
+}
+
+[[nodiscard]] inline auto add_blocks(
+  data_t& io_data,
+  const std::type_info& type,
+  size_t count,
+  size_t bytes_per_block
+) -> size_t {
+  const auto bytes = count * footprint(io_data, bytes_per_block);
+  return add_block(io_data, block_t{ count, bytes, std::addressof(type), false, bytes, bytes });
+}
+
+// Returns true if the address was not visited before
+[[nodiscard]] inline auto insert_address(
+  data_t& io_data,
+  byteptr_t address
+) -> bool {
+#ifdef WIB_PARALLEL_ENABLED
+  return io_data.shared_addresses != nullptr ?
+    io_data.shared_addresses->insert(address) :
+    io_data.handled_addresses.insert(address);
+#else
+  return io_data.handled_addresses.insert(address);
+#endif
+}
+
+[[nodiscard]] inline auto contains_address(
+  data_t& io_data,
+  byteptr_t address
+) -> bool {
+#ifdef WIB_PARALLEL_ENABLED
+  return io_data.shared_addresses != nullptr ?
+    io_data.shared_addresses->contains(address) :
+    io_data.handled_addresses.contains(address);
+#else
+  return io_data.handled_addresses.contains(address);
+#endif
+}
+
+// Registers a single heap block, block_start is the address returned by the
+// allocator if known
+[[nodiscard]] inline auto add_single_block(
+  data_t& io_data,
+  const std::type_info& type,
+  size_t bytes,
+  const void* block_start
+) -> size_t {
+  const auto block = block_t{ 1, footprint(io_data, bytes, block_start), std::addressof(type), false, bytes, bytes, block_start };
+  return add_block(io_data, block);
+}
+
+// Registers the buffer of a container with capacity()
+[[nodiscard]] inline auto add_capacity_block(
+  data_t& io_data,
+  const std::type_info& type,
+  size_t capacity_bytes,
+  size_t used_bytes,
+  const void* block_start = nullptr
+) -> size_t {
+  const auto block = block_t{ 1, footprint(io_data, capacity_bytes, block_start), std::addressof(type), true, used_bytes, capacity_bytes, block_start };
+  return add_block(io_data, block);
+}
+
+
 template <typename AnyTypeList, typename T>
 [[nodiscard]] auto get_heap_allocated_bytes(
   const T& value, 
   data_t& io_data
+) -> size_t;
+
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto measure_temporary(
+  const T& value,
+  data_t& io_data
+) -> size_t;
+
+template <typename AnyTypeList, typename Range>
+[[nodiscard]] auto accumulate_range_sampled(
+  const Range& range,
+  data_t& io_data
+) -> size_t;
+
+#ifdef WIB_PARALLEL_ENABLED
+template <typename Range>
+[[nodiscard]] auto parallel_thread_count(
+  const Range& range,
+  const parallel_t& parallel
+) -> size_t;
+
+template <typename AnyTypeList, typename Range>
+[[nodiscard]] auto accumulate_range_parallel(
+  const Range& range,
+  size_t thread_count,
+  data_t& io_data
+) -> size_t;
+#endif
+
+// Measures a member or element of the current object, entering it as a
+// segment of the path if observed
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto measure_segment(
+  const T& value,
+  const segment_t& segment,
+  data_t& io_data
 ) -> size_t {
-  // Skip plain simple types (int, float, char, bool, enum etc)
-  if constexpr (
-    std::is_arithmetic_v<T> ||
-    std::is_enum_v<T>
-  ) {
+  if constexpr (never_allocates_v<T>) {
+    return 0;
+  }
+  else {
+    if (io_data.observer == nullptr) {
+      return get_heap_allocated_bytes<AnyTypeList>(value, io_data);
+    }
+    io_data.observer->enter(segment);
+    const auto bytes = get_heap_allocated_bytes<AnyTypeList>(value, io_data);
+    io_data.observer->leave();
+    return bytes;
+  }
+}
+
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto measure_pointee_frame(
+  const frame_t& frame,
+  data_t& io_data
+) -> size_t {
+  return get_heap_allocated_bytes<AnyTypeList>(*static_cast<const T*>(frame.address), io_data);
+}
+
+// Iterators which are not random access are kept in frame_t::cursor
+template <typename Iterator>
+constexpr auto is_random_access_v = std::is_base_of_v<
+  std::random_access_iterator_tag,
+  typename std::iterator_traits<Iterator>::iterator_category
+>;
+template <typename Iterator>
+constexpr auto is_deferrable_iterator_v =
+  is_random_access_v<Iterator> || (
+    std::is_trivially_copyable_v<Iterator> &&
+    sizeof(Iterator) <= sizeof(frame_t::cursor) &&
+    alignof(Iterator) <= alignof(frame_t)
+  );
+
+// Measures the elements of a range from frame.index onwards. Once an element
+// defers frames of its own, the rest of the range is deferred below them so
+// that the elements are measured in order.
+template <typename AnyTypeList, typename Range>
+[[nodiscard]] auto measure_range_frame(
+  const frame_t& frame,
+  data_t& io_data
+) -> size_t {
+  const auto& range = *static_cast<const Range*>(frame.address);
+  using iterator_t = decltype(std::begin(range));
+  auto it = std::begin(range);
+  if constexpr (is_random_access_v<iterator_t>) {
+    std::advance(it, static_cast<typename std::iterator_traits<iterator_t>::difference_type>(frame.index));
+  }
+  else {
+    std::memcpy(static_cast<void*>(std::addressof(it)), frame.cursor.data(), sizeof(it));
+  }
+  auto& work_stack = *io_data.work_stack;
+  const auto last = std::end(range);
+  auto bytes = size_t{ 0 };
+  for (auto index = frame.index; it != last && !io_data.halted; ++index) {
+    const auto stack_size = work_stack.size();
+    bytes += measure_segment<AnyTypeList>(*it, segment_t{ esegment::Element, {}, index }, io_data);
+    ++it;
+    if (work_stack.size() > stack_size && it != last) {
+      auto next_frame = frame;
+      next_frame.index = index + 1;
+      if constexpr (!is_random_access_v<iterator_t>) {
+        std::memcpy(next_frame.cursor.data(), static_cast<const void*>(std::addressof(it)), sizeof(it));
+      }
+      // The position of the frame was consumed when it was restored
+      next_frame.position = io_data.observer != nullptr ? io_data.observer->position() : 0;
+      work_stack.insert(work_stack.begin() + static_cast<std::ptrdiff_t>(stack_size), next_frame);
+      break;
+    }
+  }
+  return bytes;
+}
+
+// Defers the elements of a non-empty range to the work stack, returns false
+// if the elements must be measured directly
+template <typename AnyTypeList, typename Range>
+[[nodiscard]] auto defer_range(
+  const Range& range,
+  data_t& io_data
+) -> bool {
+  using iterator_t = decltype(std::begin(range));
+  if constexpr (!is_deferrable_iterator_v<iterator_t>) {
+    return false;
+  }
+  else {
+    const auto first = std::begin(range);
+    if (first == std::end(range)) {
+      return true;
+    }
+    auto frame = frame_t{
+      std::addressof(range),
+      &measure_range_frame<AnyTypeList, Range>,
+      io_data.current_depth,
+      io_data.observer != nullptr ? io_data.observer->position() : 0
+    };
+    if constexpr (!is_random_access_v<iterator_t>) {
+      std::memcpy(frame.cursor.data(), static_cast<const void*>(std::addressof(first)), sizeof(first));
+    }
+    io_data.work_stack->push_back(frame);
+    return true;
+  }
+}
+
+
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto get_heap_allocated_bytes(
+  const T& value, 
+  data_t& io_data
+) -> size_t {
+  // Skip types which cannot own heap memory (int, float, enum, std::array<int, N> etc)
+  if constexpr (never_allocates_v<T>) {
     return 0;
   }
 
-  const auto current_depth = io_data.current_depth;
+  // Nodes beyond max_depth are rejected before counting them as visited
+  if (io_data.halted) {
+    return 0;
+  }
+  if (io_data.current_depth > io_data.max_depth) {
+    io_data.depth_truncated = true;
+    return 0;
+  }
+  if (!visit_node(io_data)) {
+    return 0;
+  }
+#ifdef WIB_STATS_ENABLED
+  io_data.stats.max_depth_reached = std::max(io_data.stats.max_depth_reached, io_data.current_depth);
+#endif
   ++io_data.current_depth;
   const auto scope_exit = wibutil::scope_exit_t{ 
     [&io_data]() { --io_data.current_depth; } 
   };
+  if (io_data.observer != nullptr) {
+    io_data.observer->object(typeid(T));
+  }
   const auto record_unknown_types = io_data.unknown_types != nullptr;
 
-  auto accumulate_pointer_f = [&io_data](const auto* ptr) -> size_t {
+  // block_start is the address returned by the allocator if known,
+  // extra_bytes are allocated in the same block as the pointee
+  auto accumulate_pointer_f = [&io_data](const auto* ptr, const void* block_start = nullptr, size_t extra_bytes = 0) -> size_t {
     if (ptr == nullptr) {
       return 0;
     }
-    const auto* byteptr = reinterpret_cast<byteptr_t>(ptr);
-    if (
-      const auto is_handled = io_data.handled_addresses.count(byteptr) > 0;
-      is_handled
-     ) {
+    const auto is_handled = !insert_address(io_data, reinterpret_cast<byteptr_t>(ptr));
+    using value_t = std::remove_pointer_t<decltype(ptr)>;
+    if (io_data.observer != nullptr) {
+      io_data.observer->pointer(ptr, typeid(value_t), !is_handled);
+    }
+    if (is_handled) {
+#ifdef WIB_STATS_ENABLED
+      ++io_data.stats.pointers_deduplicated;
+#endif
       return 0;
     }
-    io_data.handled_addresses.insert(byteptr);
-    using value_t = std::remove_pointer_t<decltype(ptr)>;
-    return get_heap_allocated_bytes<AnyTypeList>(*ptr, io_data) + sizeof(value_t);
+    if (io_data.work_stack != nullptr) {
+      if constexpr (!never_allocates_v<value_t>) {
+        io_data.work_stack->push_back(frame_t{
+          ptr,
+          &measure_pointee_frame<AnyTypeList, std::remove_cv_t<value_t>>,
+          io_data.current_depth,
+          io_data.observer != nullptr ? io_data.observer->position() : 0
+        });
+      }
+      return add_single_block(io_data, typeid(value_t), sizeof(value_t) + extra_bytes, block_start);
+    }
+    const auto pointee_bytes = get_heap_allocated_bytes<AnyTypeList>(*ptr, io_data);
+    return pointee_bytes + add_single_block(io_data, typeid(value_t), sizeof(value_t) + extra_bytes, block_start);
   };
 
   auto is_inside_self_f = [
@@ -341,10 +1899,21 @@ template <typename AnyTypeList, typename T>
   }
   // has custom weight_in_bytes
   else if constexpr(type_traits::has_weight_in_bytes_v<T>) {
-    return value.weight_in_bytes();
+    return add_block(io_data, block_t{ 0, static_cast<size_t>(value.weight_in_bytes()), std::addressof(typeid(T)) });
   }
   // has custom as_tuple
   else if constexpr (type_traits::as_tuple_v<T>) {
+    using tuple_t = type_traits::bare_t<type_traits::as_tuple_t<T>>;
+    constexpr auto is_temporary =
+      !std::is_reference_v<type_traits::as_tuple_t<T>> &&
+      !type_traits::is_tuple_of_references_v<tuple_t>;
+    if constexpr (is_temporary) {
+      // Members returned by value die with the tuple, hence everything they
+      // defer to the work stack is measured before the tuple is destroyed
+      if (io_data.work_stack != nullptr) {
+        return measure_temporary<AnyTypeList>(value.as_tuple(), io_data);
+      }
+    }
     return get_heap_allocated_bytes<AnyTypeList>(value.as_tuple(), io_data);
   }
   // objects smaller than a pointer is assumed to not heap allocate if it does not have a customized version
@@ -359,7 +1928,66 @@ template <typename AnyTypeList, typename T>
   }
   // smart_ptr
   else if constexpr (type_traits::is_smart_ptr_v<T>) {
-    return accumulate_pointer_f(value.get());
+    using element_t = typename T::element_type;
+    // Pointees of std::unique_ptr<T> with std::default_delete are allocated by
+    // the global operator new unless T has its own. A derived object may have
+    // its own operator new, hence the block start is only known when the
+    // dynamic type is T.
+    if constexpr (type_traits::is_unique_ptr_v<T> && !std::is_array_v<element_t>) {
+      const auto* block_start = static_cast<const void*>(nullptr);
+      if constexpr (
+        std::is_same_v<typename T::deleter_type, std::default_delete<element_t>> &&
+        !type_traits::has_member_operator_new_v<element_t>
+      ) {
+        if constexpr (std::is_polymorphic_v<element_t>) {
+          if (value != nullptr && typeid(*value) == typeid(element_t)) {
+            block_start = value.get();
+          }
+        }
+        else {
+          block_start = value.get();
+        }
+      }
+      return accumulate_pointer_f(value.get(), block_start);
+    }
+    // Control blocks are counted once no matter how many std::shared_ptr
+    // share them, the bytes of an inline control block are added to the block
+    // of the pointee. The owned object and the control block are counted
+    // through a std::shared_ptr known to point to the owned object. Any other
+    // pointer sharing a counted control block is an alias and adds nothing,
+    // otherwise its pointee is counted as a separate object, as if the
+    // control block was unknown. Objects of a derived type are sized as
+    // element_t, as for std::unique_ptr.
+    else if constexpr (type_traits::is_shared_ptr_v<T>) {
+      const auto control_block = shared_ptr_layout::control_block(value);
+      if (control_block.address == nullptr) {
+        return accumulate_pointer_f(value.get());
+      }
+      const auto is_counted = control_block.is_owner ?
+        !insert_address(io_data, control_block.address) :
+        contains_address(io_data, control_block.address);
+      if (is_counted) {
+        if (io_data.observer != nullptr) {
+          io_data.observer->pointer(value.get(), typeid(element_t), false);
+        }
+#ifdef WIB_STATS_ENABLED
+        ++io_data.stats.pointers_deduplicated;
+#endif
+        return 0;
+      }
+      if (!control_block.is_owner) {
+        return accumulate_pointer_f(value.get());
+      }
+      if (control_block.is_inline) {
+        return accumulate_pointer_f(value.get(), nullptr, control_block.bytes);
+      }
+      return
+        accumulate_pointer_f(value.get()) +
+        add_single_block(io_data, typeid(T), control_block.bytes, nullptr);
+    }
+    else {
+      return accumulate_pointer_f(value.get());
+    }
   }
   // raw pointer
   else if constexpr (std::is_pointer_v<T>) {
@@ -383,15 +2011,17 @@ template <typename AnyTypeList, typename T>
   // std::pair
   else if constexpr (type_traits::is_pair_v<T>) {
     const auto bytes = 
-      get_heap_allocated_bytes<AnyTypeList>(value.first, io_data) +
-      get_heap_allocated_bytes<AnyTypeList>(value.second, io_data);
+      measure_segment<AnyTypeList>(value.first, segment_t{ esegment::Member, "first", 0 }, io_data) +
+      measure_segment<AnyTypeList>(value.second, segment_t{ esegment::Member, "second", 1 }, io_data);
     return bytes;
   }
   // std::tuple
   else if constexpr (type_traits::is_tuple_v<T>) {
     auto allocation_bytes = size_t{ 0 };
-    wibutil::tuple_for_each(value, [&allocation_bytes, &io_data](auto&& element) -> void {
-      allocation_bytes += get_heap_allocated_bytes<AnyTypeList>(element, io_data);
+    auto element_index = size_t{ 0 };
+    wibutil::tuple_for_each(value, [&allocation_bytes, &element_index, &io_data](auto&& element) -> void {
+      const auto segment = segment_t{ esegment::Member, {}, element_index++ };
+      allocation_bytes += measure_segment<AnyTypeList>(element, segment, io_data);
     });
     return allocation_bytes;
   }
@@ -400,10 +2030,43 @@ template <typename AnyTypeList, typename T>
     type_traits::has_begin_v<T> &&
     type_traits::has_end_v<T>
   ) {
-    auto accumulate_range_f = [&io_data](const auto& range) noexcept -> size_t {
+    auto accumulate_range_f = [&io_data](const auto& range) -> size_t {
+      using element_t = type_traits::bare_t<decltype(*std::begin(range))>;
+      if constexpr (never_allocates_v<element_t>) {
+#ifdef WIB_STATS_ENABLED
+        ++io_data.stats.ranges_short_circuited;
+#endif
+        return 0;
+      }
+      if (io_data.halted) {
+        return 0;
+      }
+#ifdef WIB_STATS_ENABLED
+      ++io_data.stats.ranges_walked;
+#endif
+      if (io_data.sampling != nullptr) {
+        return accumulate_range_sampled<AnyTypeList>(range, io_data);
+      }
+#ifdef WIB_PARALLEL_ENABLED
+      if (io_data.parallel != nullptr) {
+        if (const auto thread_count = parallel_thread_count(range, *io_data.parallel); thread_count > 1) {
+          return accumulate_range_parallel<AnyTypeList>(range, thread_count, io_data);
+        }
+      }
+#endif
+      // Nested containers are measured from the work stack as pointees are,
+      // hence their depth is not bounded by the thread stack either
+      if (io_data.work_stack != nullptr && defer_range<AnyTypeList>(range, io_data)) {
+        return 0;
+      }
       auto bytes = size_t{ 0 };
+      auto element_index = size_t{ 0 };
       for (auto&& element : range) {
-        bytes += get_heap_allocated_bytes<AnyTypeList>(element, io_data);
+        if (io_data.halted) {
+          break;
+        }
+        const auto segment = segment_t{ esegment::Element, {}, element_index++ };
+        bytes += measure_segment<AnyTypeList>(element, segment, io_data);
       }
       return bytes;
     };
@@ -414,27 +2077,72 @@ template <typename AnyTypeList, typename T>
       type_traits::has_capacity_v<T>;
     constexpr auto is_map = 
       type_traits::is_map_v<T>;
+    // Nodes of std containers are never stored inside the container itself,
+    // hence the node allocations are known from size() without iterating
+    constexpr auto is_node_container =
+      type_traits::is_node_container_v<T>;
     if constexpr (is_vector_bool) {
-      return value.capacity() / 8;
+      return value.capacity() == 0 ?
+        0 :
+        add_capacity_block(io_data, typeid(T), value.capacity() / 8, (value.size() + 7) / 8);
     }
     else if constexpr (is_continuous_memory) {
       using value_type = typename T::value_type;
       const auto is_stack_allocated = is_inside_self_f(value.data());
+      // Only the buffers of std::vector and std::basic_string are known to be
+      // allocated by operator new, other containers with data() may point
+      // into pools, mapped memory or an inline buffer
+      const auto* block_start = type_traits::is_std_allocated_buffer_v<T> ?
+        static_cast<const void*>(value.data()) :
+        nullptr;
       const auto allocation_bytes = 
         value.data() == nullptr ? size_t{ 0 }:
         is_stack_allocated ? size_t{ 0 }:
-        sizeof(value_type) * value.capacity();
+        add_capacity_block(io_data, typeid(T), sizeof(value_type) * value.capacity(), sizeof(value_type) * value.size(), block_start);
+      return allocation_bytes + accumulate_range_f(value);
+    }
+    else if constexpr (type_traits::is_deque_v<T>) {
+      // Unused parts of the chunks and the map cannot be reclaimed by
+      // shrink_to_fit() and are counted as structural overhead, not slack
+      const auto layout = deque_layout::layout(value);
+      auto allocation_bytes = size_t{ 0 };
+      if (layout.chunk_count > 0) {
+        allocation_bytes += add_blocks(io_data, typeid(T), layout.chunk_count, layout.chunk_bytes);
+      }
+      if (layout.map_slots > 0) {
+        allocation_bytes += add_single_block(io_data, typeid(T), sizeof(void*) * layout.map_slots, nullptr);
+      }
+      return allocation_bytes + accumulate_range_f(value);
+    }
+    else if constexpr (is_node_container) {
+      // std::forward_list has no size() and is counted by iterating
+      auto node_count = size_t{ 0 };
+      if constexpr (type_traits::has_size_v<const T>) {
+        node_count = value.size();
+      }
+      else {
+        node_count = static_cast<size_t>(std::distance(std::begin(value), std::end(value)));
+      }
+      auto allocation_bytes =
+        add_blocks(io_data, typeid(T), node_count, node_bytes_v<T>);
+      if (const auto bucket_bytes = node_layout::bucket_bytes(value); bucket_bytes > 0) {
+        allocation_bytes += add_single_block(io_data, typeid(T), bucket_bytes, nullptr);
+      }
       return allocation_bytes + accumulate_range_f(value);
     }
     else if constexpr (is_map) {
       auto allocation_bytes = size_t{ 0 };
       for (auto&& kvp : value) {
         // We might be dealing with a small map of some sort
+        auto node_bytes = size_t{ 0 };
         if (!is_inside_self_f(std::addressof(kvp.first))) {
-          allocation_bytes += sizeof(kvp.first);
+          node_bytes += sizeof(kvp.first);
         }
         if (!is_inside_self_f(std::addressof(kvp.second))) {
-          allocation_bytes += sizeof(kvp.second);
+          node_bytes += sizeof(kvp.second);
+        }
+        if (node_bytes > 0) {
+          allocation_bytes += add_blocks(io_data, typeid(T), 1, node_bytes);
         }
       }
       return allocation_bytes + accumulate_range_f(value);
@@ -443,7 +2151,7 @@ template <typename AnyTypeList, typename T>
       auto allocation_bytes = size_t{ 0 };
       for (const auto& element : value) {
         if (!is_inside_self_f(std::addressof(element))) {
-          allocation_bytes += sizeof(element);
+          allocation_bytes += add_blocks(io_data, typeid(T), 1, sizeof(element));
         }
       }
       return allocation_bytes + accumulate_range_f(value);
@@ -459,7 +2167,7 @@ template <typename AnyTypeList, typename T>
       bytes += get_heap_allocated_bytes<AnyTypeList>(casted_value, io_data);
       // Element might be allocated in small storage
       if (!is_inside_self_f(std::addressof(casted_value))) {
-        bytes += sizeof(casted_value);
+        bytes += add_blocks(io_data, typeid(casted_value), 1, sizeof(casted_value));
       }
     };
     const auto handled =
@@ -468,6 +2176,9 @@ template <typename AnyTypeList, typename T>
     if (!handled && record_unknown_types) {
       io_data.unknown_types->emplace(value.type());
     }
+    if (!handled && io_data.observer != nullptr) {
+      io_data.observer->unknown_type(value.type());
+    }
     return bytes;
   }
   // access members via cereal
@@ -477,8 +2188,17 @@ template <typename AnyTypeList, typename T>
     type_traits::has_cereal_save_v<T> 
   ) {
     auto bytes = size_t{ 0 };
-    auto visitor = [&io_data, &bytes](auto&& member) -> void {
-      bytes += get_heap_allocated_bytes<AnyTypeList>(member, io_data);
+    auto member_index = size_t{ 0 };
+    auto visitor = [&io_data, &bytes, &member_index](auto&& member) -> void {
+      using member_t = type_traits::bare_t<decltype(member)>;
+      if constexpr (type_traits::is_name_value_pair_v<member_t>) {
+        const auto segment = segment_t{ esegment::Member, member.name, member_index++ };
+        bytes += measure_segment<AnyTypeList>(member.value, segment, io_data);
+      }
+      else {
+        const auto segment = segment_t{ esegment::Member, {}, member_index++ };
+        bytes += measure_segment<AnyTypeList>(member, segment, io_data);
+      }
     };
     using visitor_t = decltype(visitor);
     auto archive_inspector = wibutil::cereal_archive_inspector<visitor_t>{visitor};
@@ -500,15 +2220,22 @@ template <typename AnyTypeList, typename T>
     }
     else {
       auto bytes = size_t{ 0 };
-      boost::pfr::for_each_field(value, [&bytes, &io_data](auto&& member) {
-        bytes += get_heap_allocated_bytes<AnyTypeList>(member, io_data);
+      boost::pfr::for_each_field(value, [&bytes, &io_data](auto&& member, size_t member_index) {
+#if defined(BOOST_PFR_CORE_NAME_ENABLED) && BOOST_PFR_CORE_NAME_ENABLED
+        const auto segment = segment_t{ esegment::Member, boost::pfr::names_as_array<T>()[member_index], member_index };
+#else
+        const auto segment = segment_t{ esegment::Member, {}, member_index };
+#endif
+        bytes += measure_segment<AnyTypeList>(member, segment, io_data);
       });
       return bytes;
     }
 #elif defined(WIB_CISTA_ENABLED)
     auto bytes = size_t{ 0 };
-    cista::for_each_field(value, [&bytes, &io_data](auto&& member) {
-      bytes += get_heap_allocated_bytes<AnyTypeList>(member, io_data);
+    auto member_index = size_t{ 0 };
+    cista::for_each_field(value, [&bytes, &member_index, &io_data](auto&& member) {
+      const auto segment = segment_t{ esegment::Member, {}, member_index++ };
+      bytes += measure_segment<AnyTypeList>(member, segment, io_data);
     });
     return bytes;
 #endif
@@ -519,14 +2246,540 @@ template <typename AnyTypeList, typename T>
     const auto& type_info = typeid(T);
     io_data.unknown_types->emplace(type_info);
   }
+  if (io_data.observer != nullptr) {
+    io_data.observer->unknown_type(typeid(T));
+  }
 
   // could not approximate bytes
   return 0;
 }
 
 
+// Measures the pointees deferred to the work stack, if any, until only
+// stack_size frames remains
+[[nodiscard]] inline auto drain_work_stack(
+  data_t& io_data,
+  size_t stack_size = 0
+) -> size_t {
+  if (io_data.work_stack == nullptr) {
+    return 0;
+  }
+  auto bytes = size_t{ 0 };
+  auto& work_stack = *io_data.work_stack;
+  while (work_stack.size() > stack_size && !io_data.halted) {
+    const auto frame = work_stack.back();
+    work_stack.pop_back();
+    io_data.current_depth = frame.depth;
+    if (io_data.observer != nullptr) {
+      io_data.observer->restore(frame.position);
+    }
+    bytes += frame.measure(frame, io_data);
+  }
+  return bytes;
 }
 
+// Measures a value which is destroyed when the caller returns, together with
+// everything it defers to the work stack. The depth and the path are restored
+// afterwards as the frames leave them where the last one ended.
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto measure_temporary(
+  const T& value,
+  data_t& io_data
+) -> size_t {
+  const auto stack_size = io_data.work_stack->size();
+  const auto depth = io_data.current_depth;
+  const auto position = io_data.observer != nullptr ? io_data.observer->position() : 0;
+  const auto bytes =
+    get_heap_allocated_bytes<AnyTypeList>(value, io_data) +
+    drain_work_stack(io_data, stack_size);
+  // Frames left by a halted traversal must not outlive the value
+  io_data.work_stack->resize(stack_size);
+  io_data.current_depth = depth;
+  if (io_data.observer != nullptr) {
+    io_data.observer->restore(position);
+  }
+  return bytes;
+}
+
+// Measures value and, if a work stack is used, all pointees deferred to it
+template <typename AnyTypeList, typename T>
+[[nodiscard]] auto traverse(
+  const T& value,
+  data_t& io_data
+) -> size_t {
+  const auto bytes = get_heap_allocated_bytes<AnyTypeList>(value, io_data);
+  return bytes + drain_work_stack(io_data);
+}
+
+
+// Measures sample_size elements of the range and extrapolates by the number
+// of elements, ranges without random access are sampled from a prefix. The
+// variance of the extrapolation, including the variance of nested sampled
+// ranges, is added to sampling_t::variance.
+template <typename AnyTypeList, typename Range>
+auto accumulate_range_sampled(
+  const Range& range,
+  data_t& io_data
+) -> size_t {
+  auto& sampling = *io_data.sampling;
+  const auto first = std::begin(range);
+  // Ranges without size(), such as std::forward_list, are counted by stepping
+  // through them once
+  const auto element_count = [&range, &first]() -> size_t {
+    if constexpr (type_traits::has_size_v<const Range>) {
+      return range.size();
+    }
+    else {
+      return static_cast<size_t>(std::distance(first, std::end(range)));
+    }
+  }();
+  const auto sample_size = sampling.sample_size;
+  if (element_count <= sample_size || sample_size == 0) {
+    auto bytes = size_t{ 0 };
+    for (auto&& element : range) {
+      if (io_data.halted) {
+        break;
+      }
+      bytes += get_heap_allocated_bytes<AnyTypeList>(element, io_data);
+    }
+    return bytes;
+  }
+
+  // Welford's running mean and variance of the sampled elements
+  auto samples = size_t{ 0 };
+  auto mean = 0.0;
+  auto m2 = 0.0;
+  auto nested_variance = 0.0;
+  auto add_sample_f = [&](const auto& element) -> void {
+    // Pointees deferred to the work stack are measured as part of the element
+    const auto stack_size = io_data.work_stack != nullptr ? io_data.work_stack->size() : 0;
+    const auto variance_before = sampling.variance;
+    const auto bytes = static_cast<double>(
+      get_heap_allocated_bytes<AnyTypeList>(element, io_data) +
+      drain_work_stack(io_data, stack_size)
+    );
+    nested_variance += sampling.variance - variance_before;
+    sampling.variance = variance_before;
+    ++samples;
+    const auto delta = bytes - mean;
+    mean += delta / static_cast<double>(samples);
+    m2 += delta * (bytes - mean);
+  };
+  // Ranges without random access are stepped through up to the last sample,
+  // hence only a prefix bounded by the sample size is sampled
+  using iterator_t = decltype(std::begin(range));
+  using difference_t = typename std::iterator_traits<iterator_t>::difference_type;
+  constexpr auto is_random_access = std::is_base_of_v<
+    std::random_access_iterator_tag,
+    typename std::iterator_traits<iterator_t>::iterator_category
+  >;
+  // The prefix saturates at the element count rather than overflowing
+  const auto prefix_count = sampling.prefix_factor > element_count / sample_size ?
+    element_count :
+    sample_size * sampling.prefix_factor;
+  const auto sampled_count = is_random_access ?
+    element_count :
+    std::min(element_count, std::max(sample_size, prefix_count));
+  if (sampled_count < element_count) {
+    sampling.is_prefix_sampled = true;
+  }
+  auto stratum_index_f = [&sampling, sampled_count, sample_size](size_t stratum) -> size_t {
+    const auto stratum_first = stratum * sampled_count / sample_size;
+    const auto stratum_last = (stratum + 1) * sampled_count / sample_size;
+    auto distribution = std::uniform_int_distribution<size_t>{ stratum_first, stratum_last - 1 };
+    return distribution(sampling.rng);
+  };
+
+  const auto is_random = is_random_access && sampling.method == esampling::Random;
+  if constexpr (is_random_access) {
+    auto distribution = std::uniform_int_distribution<size_t>{ 0, element_count - 1 };
+    for (size_t i = 0; i < sample_size; ++i) {
+      const auto idx = is_random ? distribution(sampling.rng) : stratum_index_f(i);
+      add_sample_f(first[static_cast<difference_t>(idx)]);
+    }
+  }
+  else {
+    // Ranges without random access are always stratified in a single pass
+    // over the prefix
+    auto it = first;
+    auto it_idx = size_t{ 0 };
+    for (size_t i = 0; i < sample_size; ++i) {
+      const auto idx = stratum_index_f(i);
+      std::advance(it, static_cast<difference_t>(idx - it_idx));
+      it_idx = idx;
+      add_sample_f(*it);
+    }
+  }
+
+  const auto n = static_cast<double>(element_count);
+  const auto k = static_cast<double>(sample_size);
+  const auto sample_variance = samples > 1 ? m2 / (k - 1.0) : 0.0;
+  // Sampling with replacement has no finite population correction, a prefix
+  // is the population its samples are drawn from
+  const auto fpc = is_random ? 1.0 : 1.0 - k / static_cast<double>(sampled_count);
+  sampling.variance += n * n * fpc * sample_variance / k + (n / k) * nested_variance;
+  return static_cast<size_t>(std::llround(mean * n));
+}
+
+
+// State of shrink_to_fit_all()
+struct shrink_data_t {
+  const size_t min_slack_bytes{};
+  address_set_t& handled_addresses;
+};
+
+// Heap allocated bytes of the buffer of a container with capacity()
+template <typename T>
+[[nodiscard]] auto buffer_bytes(
+  const T& value
+) -> size_t {
+  if constexpr (std::is_same_v<std::vector<bool>, T>) {
+    return value.capacity() / 8;
+  }
+  else {
+    const auto* first = reinterpret_cast<byteptr_t>(std::addressof(value));
+    const auto* data = reinterpret_cast<byteptr_t>(value.data());
+    const auto is_stack_allocated = data >= first && data < first + sizeof(value);
+    return data == nullptr || is_stack_allocated ?
+      0 :
+      sizeof(typename T::value_type) * value.capacity();
+  }
+}
+
+// Mutable counterpart of get_heap_allocated_bytes(), members reached via the
+// const reflection functions (as_tuple(), save()) belongs to the mutable
+// value and are hence const_cast
+template <typename AnyTypeList, typename T>
+auto shrink_heap_allocations(
+  T& value,
+  shrink_data_t& io_data
+) -> size_t {
+  auto shrink_f = [&io_data](const auto& member) -> size_t {
+    using member_t = type_traits::bare_t<decltype(member)>;
+    return shrink_heap_allocations<AnyTypeList>(const_cast<member_t&>(member), io_data);
+  };
+
+  if constexpr (never_allocates_v<T>) {
+    return 0;
+  }
+  // non-allocating std types and opaque custom types
+  else if constexpr (
+    type_traits::is_string_view_v<T> ||
+    type_traits::is_weak_ptr_v<T> ||
+    type_traits::has_weight_in_bytes_v<T>
+  ) {
+    return 0;
+  }
+  // has custom as_tuple, members returned by value cannot be shrunk
+  else if constexpr (type_traits::as_tuple_v<T>) {
+    using tuple_t = type_traits::bare_t<type_traits::as_tuple_t<T>>;
+    if constexpr (type_traits::is_tuple_of_references_v<tuple_t>) {
+      auto tpl = value.as_tuple();
+      return shrink_heap_allocations<AnyTypeList>(tpl, io_data);
+    }
+    else {
+      return 0;
+    }
+  }
+  else if constexpr (sizeof(value) < sizeof(const void*)) {
+    return 0;
+  }
+  else if constexpr (type_traits::is_optional_v<T>) {
+    return value.has_value() ? shrink_heap_allocations<AnyTypeList>(*value, io_data) : 0;
+  }
+  // smart_ptr, pointees created as const must not be modified
+  else if constexpr (type_traits::is_smart_ptr_v<T>) {
+    using element_t = typename T::element_type;
+    if constexpr (std::is_const_v<element_t>) {
+      return 0;
+    }
+    else {
+      auto* ptr = value.get();
+      if (ptr == nullptr || !io_data.handled_addresses.insert(reinterpret_cast<byteptr_t>(ptr))) {
+        return 0;
+      }
+      return shrink_heap_allocations<AnyTypeList>(*ptr, io_data);
+    }
+  }
+  // raw pointers are not assumed to own their pointee
+  else if constexpr (std::is_pointer_v<T>) {
+    return 0;
+  }
+  else if constexpr (type_traits::is_variant_v<T>) {
+    if (value.valueless_by_exception()) {
+      return 0;
+    }
+    return std::visit(
+      [&io_data](auto& variant_value) -> size_t {
+        return shrink_heap_allocations<AnyTypeList>(variant_value, io_data);
+      },
+      value
+    );
+  }
+  else if constexpr (type_traits::is_pair_v<T>) {
+    auto bytes = size_t{ 0 };
+    if constexpr (!std::is_const_v<typename T::first_type>) {
+      bytes += shrink_f(value.first);
+    }
+    if constexpr (!std::is_const_v<typename T::second_type>) {
+      bytes += shrink_f(value.second);
+    }
+    return bytes;
+  }
+  // std::tuple, elements might be references to members
+  else if constexpr (type_traits::is_tuple_v<T>) {
+    auto bytes = size_t{ 0 };
+    wibutil::tuple_for_each(value, [&bytes, &shrink_f](const auto& element) -> void {
+      bytes += shrink_f(element);
+    });
+    return bytes;
+  }
+  // container, elements are shrunk before the container itself
+  else if constexpr (
+    type_traits::has_begin_v<T> &&
+    type_traits::has_end_v<T>
+  ) {
+    using reference_t = decltype(*std::begin(value));
+    using element_t = type_traits::bare_t<reference_t>;
+    auto bytes = size_t{ 0 };
+    if constexpr (type_traits::is_map_v<T>) {
+      if constexpr (!never_allocates_v<typename T::mapped_type>) {
+        for (auto& kvp : value) {
+          bytes += shrink_heap_allocations<AnyTypeList>(kvp.second, io_data);
+        }
+      }
+    }
+    // Elements of sets and proxies such as std::vector<bool>::reference are skipped
+    else if constexpr (
+      !never_allocates_v<element_t> &&
+      std::is_lvalue_reference_v<reference_t> &&
+      !std::is_const_v<std::remove_reference_t<reference_t>>
+    ) {
+      for (auto& element : value) {
+        bytes += shrink_heap_allocations<AnyTypeList>(element, io_data);
+      }
+    }
+    if constexpr (
+      type_traits::has_capacity_v<T> &&
+      type_traits::has_shrink_to_fit_v<T>
+    ) {
+      const auto used_bytes = std::is_same_v<std::vector<bool>, T> ?
+        (value.size() + 7) / 8 :
+        sizeof(element_t) * value.size();
+      const auto bytes_before = buffer_bytes(value);
+      const auto slack_bytes = bytes_before > used_bytes ? bytes_before - used_bytes : 0;
+      if (slack_bytes > 0 && slack_bytes >= io_data.min_slack_bytes) {
+        value.shrink_to_fit();
+        const auto bytes_after = buffer_bytes(value);
+        bytes += bytes_before > bytes_after ? bytes_before - bytes_after : 0;
+      }
+    }
+    return bytes;
+  }
+  else if constexpr (type_traits::is_any_v<T>) {
+    auto bytes = size_t{ 0 };
+    [[maybe_unused]] const auto handled = wibutil::try_visit_any<AnyTypeList>(
+      value,
+      [&bytes, &shrink_f](const auto& casted_value) -> void { bytes += shrink_f(casted_value); }
+    );
+    return bytes;
+  }
+#ifdef WIB_CEREAL_ENABLED
+  else if constexpr (
+    type_traits::has_cereal_serialize_v<T> ||
+    type_traits::has_cereal_save_v<T>
+  ) {
+    auto bytes = size_t{ 0 };
+    auto visitor = [&bytes, &shrink_f](auto&& member) -> void {
+      using member_t = type_traits::bare_t<decltype(member)>;
+      if constexpr (type_traits::is_name_value_pair_v<member_t>) {
+        bytes += shrink_f(member.value);
+      }
+      else {
+        bytes += shrink_f(member);
+      }
+    };
+    using visitor_t = decltype(visitor);
+    auto archive_inspector = wibutil::cereal_archive_inspector<visitor_t>{visitor};
+    if constexpr (type_traits::has_cereal_serialize_v<T>) {
+      value.serialize(archive_inspector);
+    }
+    else {
+      value.save(archive_inspector);
+    }
+    return bytes;
+  }
+#endif
+  else if constexpr (std::is_aggregate_v<T>) {
+#if defined(WIB_PFR_ENABLED)
+    auto bytes = size_t{ 0 };
+    if constexpr (boost::pfr::tuple_size_v<T> != 0) {
+      boost::pfr::for_each_field(value, [&bytes, &io_data](auto& member) {
+        bytes += shrink_heap_allocations<AnyTypeList>(member, io_data);
+      });
+    }
+    return bytes;
+#elif defined(WIB_CISTA_ENABLED)
+    auto bytes = size_t{ 0 };
+    cista::for_each_field(value, [&bytes, &io_data](auto& member) {
+      bytes += shrink_heap_allocations<AnyTypeList>(member, io_data);
+    });
+    return bytes;
+#else
+    return 0;
+#endif
+  }
+  else {
+    return 0;
+  }
+}
+
+
+#ifdef WIB_PARALLEL_ENABLED
+// Number of threads to split the elements of a range across, ranges are not
+// split unless each thread gets min_elements_per_thread elements
+template <typename Range>
+auto parallel_thread_count(
+  const Range& range,
+  const parallel_t& parallel
+) -> size_t {
+  const auto element_count = [&range]() -> size_t {
+    if constexpr (type_traits::has_size_v<const Range>) {
+      return range.size();
+    }
+    else {
+      return static_cast<size_t>(std::distance(std::begin(range), std::end(range)));
+    }
+  }();
+  return std::min(
+    parallel.thread_count,
+    element_count / std::max(size_t{ 1 }, parallel.min_elements_per_thread)
+  );
+}
+
+// Splits the elements of a range into one chunk per thread. Each worker sums
+// into its own data_t, only the address set and the budgets are shared.
+// Workers never split ranges themselves.
+template <typename AnyTypeList, typename Range>
+auto accumulate_range_parallel(
+  const Range& range,
+  const size_t thread_count,
+  data_t& io_data
+) -> size_t {
+  const auto first = std::begin(range);
+  const auto last = std::end(range);
+  const auto element_count = static_cast<size_t>(std::distance(first, last));
+
+  struct worker_result_t {
+    size_t bytes{};
+    size_t heap_blocks{};
+    size_t nodes_visited{};
+    bool depth_truncated{};
+    bool deadline_reached{};
+    bool node_budget_exhausted{};
+    typeindex_set_t unknown_types{};
+    std::exception_ptr exception{};
+#ifdef WIB_STATS_ENABLED
+    traversal_stats_t stats{};
+#endif
+  };
+  auto results = std::vector<worker_result_t>(thread_count);
+  auto shared_budget = shared_budget_t{};
+  auto worker_f = [&io_data, &shared_budget](auto chunk_first, auto chunk_last, worker_result_t& o_result) -> void {
+    try {
+      auto handled_addresses = address_set_t{};
+      auto work_stack = work_stack_t{};
+      auto current_depth = io_data.current_depth;
+      auto worker_data = data_t{
+        io_data.follow_raw_pointers,
+        handled_addresses,
+        io_data.unknown_types != nullptr ? std::addressof(o_result.unknown_types) : nullptr,
+        current_depth,
+        io_data.max_depth,
+        io_data.work_stack != nullptr ? std::addressof(work_stack) : nullptr
+      };
+      worker_data.shared_addresses = io_data.shared_addresses;
+      // The workers together may use what remains of the budgets
+      worker_data.shared_budget = std::addressof(shared_budget);
+      worker_data.byte_limit = io_data.byte_limit - io_data.counted_bytes;
+      worker_data.node_budget = io_data.node_budget - io_data.nodes_visited;
+      worker_data.deadline = io_data.deadline;
+      worker_data.allocator_model = io_data.allocator_model;
+      worker_data.block_sizes = io_data.block_sizes;
+      for (auto it = chunk_first; it != chunk_last && !worker_data.halted; ++it) {
+        o_result.bytes += get_heap_allocated_bytes<AnyTypeList>(*it, worker_data);
+      }
+      o_result.bytes += drain_work_stack(worker_data);
+      o_result.heap_blocks = worker_data.heap_blocks;
+      o_result.nodes_visited = worker_data.nodes_visited;
+      o_result.depth_truncated = worker_data.depth_truncated;
+      o_result.deadline_reached = worker_data.deadline_reached;
+      o_result.node_budget_exhausted = worker_data.node_budget_exhausted;
+#ifdef WIB_STATS_ENABLED
+      o_result.stats = worker_data.stats;
+      o_result.stats.address_set_probes += handled_addresses.probes();
+#endif
+    }
+    catch (...) {
+      o_result.exception = std::current_exception();
+    }
+  };
+
+  auto threads = std::vector<std::thread>{};
+  threads.reserve(thread_count - 1);
+  auto chunk_first = first;
+  for (size_t idx = 0; idx < thread_count; ++idx) {
+    const auto chunk_size =
+      element_count / thread_count +
+      (idx < element_count % thread_count ? 1 : 0);
+    const auto chunk_last = std::next(chunk_first, static_cast<std::ptrdiff_t>(chunk_size));
+    // The calling thread measures the last chunk itself
+    if (idx + 1 < thread_count) {
+      threads.emplace_back(worker_f, chunk_first, chunk_last, std::ref(results[idx]));
+    }
+    else {
+      worker_f(chunk_first, chunk_last, results[idx]);
+    }
+    chunk_first = chunk_last;
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto bytes = size_t{ 0 };
+  for (auto& result : results) {
+    if (result.exception) {
+      std::rethrow_exception(result.exception);
+    }
+    bytes += count_bytes(io_data, result.bytes);
+    io_data.heap_blocks += result.heap_blocks;
+    io_data.nodes_visited += result.nodes_visited;
+    io_data.depth_truncated = io_data.depth_truncated || result.depth_truncated;
+    if (result.deadline_reached || result.node_budget_exhausted) {
+      io_data.deadline_reached = io_data.deadline_reached || result.deadline_reached;
+      io_data.node_budget_exhausted = io_data.node_budget_exhausted || result.node_budget_exhausted;
+      io_data.halted = true;
+    }
+    if (io_data.unknown_types != nullptr) {
+      io_data.unknown_types->insert(result.unknown_types.begin(), result.unknown_types.end());
+    }
+#ifdef WIB_STATS_ENABLED
+    io_data.stats.pointers_deduplicated += result.stats.pointers_deduplicated;
+    io_data.stats.address_set_probes += result.stats.address_set_probes;
+    io_data.stats.max_depth_reached = std::max(io_data.stats.max_depth_reached, result.stats.max_depth_reached);
+    io_data.stats.ranges_walked += result.stats.ranges_walked;
+    io_data.stats.ranges_short_circuited += result.stats.ranges_short_circuited;
+#endif
+  }
+  return bytes;
+}
+#endif
+
+
+}
+
+
+
 
 
 
@@ -563,47 +2816,1433 @@ template <typename AnyTypeList, typename T>
 
 
 
-
-
 namespace wib {
 
+// Buffers used during measurement. Keep a context alive between
+// measurements to reuse its allocations, every measurement starts by
+// clearing the buffers hence shared pointees are counted by each of them.
+struct measurement_context_t {
+  detail::address_set_t handled_addresses{};
+  typeindex_set_t unknown_types{};
+  detail::work_stack_t work_stack{};
+  // Clears all buffers but keeps their capacity
+  auto reset() noexcept -> void {
+    handled_addresses.clear();
+    unknown_types.clear();
+    work_stack.clear();
+  }
+};
+
+namespace detail {
+[[nodiscard]] inline auto make_data(
+  measurement_context_t& context,
+  const options_t& options,
+  size_t& current_depth
+) -> data_t {
+  auto io_data = data_t{
+    options.follow_raw_pointers,
+    context.handled_addresses,
+    std::addressof(context.unknown_types),
+    current_depth,
+    options.max_depth,
+    options.traversal == etraversal::Iterative ? std::addressof(context.work_stack) : nullptr
+  };
+  io_data.byte_limit = options.byte_limit;
+  io_data.node_budget = options.node_budget;
+  io_data.deadline = options.deadline;
+  io_data.allocator_model = options.allocator_model;
+  io_data.block_sizes = options.block_sizes;
+  return io_data;
+}
+
+// Fills everything but the unknown types of the report, which are kept in
+// the context
+[[nodiscard]] inline auto make_report(
+  size_t bytes,
+  const data_t& io_data
+) -> report_t {
+  auto report = report_t{};
+  report.bytes = bytes;
+  report.heap_blocks = io_data.heap_blocks;
+  report.depth_truncated = io_data.depth_truncated;
+  report.limit_exceeded = io_data.limit_exceeded;
+  report.deadline_reached = io_data.deadline_reached;
+  report.node_budget_exhausted = io_data.node_budget_exhausted;
+  report.nodes_visited = io_data.nodes_visited;
+#ifdef WIB_STATS_ENABLED
+  report.stats = io_data.stats;
+  report.stats.nodes_visited = io_data.nodes_visited;
+#endif
+  return report;
+}
+
+template <typename AnyTypeList, typename T>
+auto measure_in_context(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options
+) -> report_t {
+  static_assert(type_traits::is_tuple_v<AnyTypeList>);
+  context.reset();
+  auto current_depth = size_t{ 0 };
+  auto io_data = make_data(context, options, current_depth);
+#ifdef WIB_STATS_ENABLED
+  const auto start_time = std::chrono::steady_clock::now();
+  const auto start_probes = context.handled_addresses.probes();
+#endif
+  const auto bytes = traverse<AnyTypeList>(value, io_data);
+#ifdef WIB_STATS_ENABLED
+  io_data.stats.wall_time = std::chrono::steady_clock::now() - start_time;
+  io_data.stats.address_set_probes += context.handled_addresses.probes() - start_probes;
+  io_data.stats.address_set_peak_size = context.handled_addresses.size();
+#endif
+  return make_report(bytes, io_data);
+}
+
+inline auto add_slack(
+  slack_t& io_slack,
+  const block_t& block
+) -> void {
+  io_slack.used_bytes += block.used_bytes;
+  io_slack.slack_bytes += block.capacity_bytes - block.used_bytes;
+  io_slack.rounding_bytes += block.bytes - block.capacity_bytes;
+  ++io_slack.containers;
+}
+
+// Builds the tree of breakdown(), nodes are kept in a flat vector during the
+// traversal and the position of the observer is the index of a node. A node
+// entered with the segment and type of one of its ancestors is folded into
+// the ancestor, hence the depth of the tree is bounded by the types.
+class breakdown_observer_t : public observer_t {
+public:
+  breakdown_observer_t() {
+    nodes_.emplace_back();
+    nodes_.front().count = 1;
+  }
+  auto enter(const segment_t& segment) -> void override {
+    path_.push_back(current_);
+    is_entered_ = true;
+    auto child = nodes_[current_].first_child;
+    while (child != no_node && !matches(nodes_[child], segment)) {
+      child = nodes_[child].next_sibling;
+    }
+    if (child == no_node) {
+      child = nodes_.size();
+      auto node = node_t{};
+      node.segment = segment;
+      node.parent = current_;
+      nodes_.push_back(node);
+      auto& parent = nodes_[current_];
+      if (parent.first_child == no_node) {
+        parent.first_child = child;
+      }
+      else {
+        nodes_[parent.last_child].next_sibling = child;
+      }
+      parent.last_child = child;
+    }
+    ++nodes_[child].count;
+    current_ = child;
+  }
+  auto leave() -> void override {
+    current_ = path_.back();
+    path_.pop_back();
+    is_entered_ = false;
+  }
+  // The first object of an entered node has the static type of the member
+  auto object(const std::type_info& type) -> void override {
+    auto& node = nodes_[current_];
+    if (node.type == nullptr) {
+      node.type = std::addressof(type);
+    }
+    if (!is_entered_) {
+      return;
+    }
+    is_entered_ = false;
+    for (auto ancestor = node.parent; ancestor != 0 && ancestor != no_node; ancestor = nodes_[ancestor].parent) {
+      const auto& candidate = nodes_[ancestor];
+      if (candidate.type != nullptr && *candidate.type == type && matches(candidate, node.segment)) {
+        --node.count;
+        ++nodes_[ancestor].count;
+        current_ = ancestor;
+        return;
+      }
+    }
+  }
+  auto block(const block_t& block) -> void override {
+    auto& node = nodes_[current_];
+    node.exclusive_bytes += block.bytes;
+    node.heap_blocks += block.count;
+    if (block.has_capacity) {
+      add_slack(node.slack, block);
+    }
+  }
+  [[nodiscard]] auto position() -> size_t override { return current_; }
+  auto restore(size_t position) -> void override {
+    current_ = position;
+    is_entered_ = false;
+  }
+  // Children are appended after their parent, hence the nodes are built from
+  // the last one without recursion. Nodes left empty by folding are dropped.
+  [[nodiscard]] auto tree() const -> breakdown_node_t {
+    auto trees = std::vector<breakdown_node_t>(nodes_.size());
+    for (auto idx = nodes_.size(); idx-- > 0;) {
+      const auto& node = nodes_[idx];
+      auto& tree = trees[idx];
+      tree.name =
+        idx == 0 ? std::string{} :
+        node.segment.kind == esegment::Element ? std::string{ "[*]" } :
+        !node.segment.name.empty() ? std::string{ node.segment.name } :
+        std::to_string(node.segment.index);
+      tree.exclusive_bytes = node.exclusive_bytes;
+      tree.inclusive_bytes += node.exclusive_bytes;
+      tree.heap_blocks = node.heap_blocks;
+      tree.count = node.count;
+      tree.slack = node.slack;
+      std::reverse(tree.children.begin(), tree.children.end());
+      const auto is_folded = tree.count == 0 && tree.children.empty() && tree.heap_blocks == 0;
+      if (idx != 0 && !is_folded) {
+        auto& parent = trees[node.parent];
+        parent.inclusive_bytes += tree.inclusive_bytes;
+        parent.children.push_back(std::move(tree));
+      }
+    }
+    return std::move(trees.front());
+  }
+private:
+  static constexpr auto no_node = std::numeric_limits<size_t>::max();
+  struct node_t {
+    segment_t segment{};
+    // Type of the first object visited at the node
+    const std::type_info* type{nullptr};
+    size_t parent{no_node};
+    size_t first_child{no_node};
+    size_t last_child{no_node};
+    size_t next_sibling{no_node};
+    size_t exclusive_bytes{};
+    size_t heap_blocks{};
+    size_t count{};
+    slack_t slack{};
+  };
+  // Elements are collapsed, members are distinguished by name and index
+  [[nodiscard]] static auto matches(const node_t& node, const segment_t& segment) -> bool {
+    return
+      node.segment.kind == segment.kind && (
+        segment.kind == esegment::Element || (
+          node.segment.index == segment.index &&
+          node.segment.name == segment.name
+        )
+      );
+  }
+  std::vector<node_t> nodes_{};
+  size_t current_{0};
+  // Nodes to return to on leave(), a folded node returns to its parent
+  std::vector<size_t> path_{};
+  bool is_entered_{false};
+};
+
+// Fills the result of weight_by_type(), consecutive events mostly concern
+// the same type hence the last entry is cached
+class type_observer_t final : public observer_t {
+public:
+  explicit type_observer_t(type_weights_t& o_weights) : weights_{ o_weights } {}
+  auto object(const std::type_info& type) -> void override {
+    ++find(type).instances;
+  }
+  auto block(const block_t& block) -> void override {
+    auto& weight = find(*block.type);
+    weight.bytes += block.bytes;
+    weight.heap_blocks += block.count;
+  }
+private:
+  [[nodiscard]] auto find(const std::type_info& type) -> type_weight_t& {
+    if (last_type_ == nullptr || *last_type_ != type) {
+      last_type_ = std::addressof(type);
+      last_weight_ = std::addressof(weights_[std::type_index{ type }]);
+    }
+    return *last_weight_;
+  }
+  type_weights_t& weights_;
+  const std::type_info* last_type_{nullptr};
+  type_weight_t* last_weight_{nullptr};
+};
+
+// Aggregates the slack by path as breakdown() and by type
+class slack_observer_t final : public breakdown_observer_t {
+public:
+  auto block(const block_t& block) -> void override {
+    breakdown_observer_t::block(block);
+    if (block.has_capacity) {
+      add_slack(by_type_[std::type_index{ *block.type }], block);
+    }
+  }
+  [[nodiscard]] auto by_type() -> std::unordered_map<std::type_index, slack_t>& { return by_type_; }
+private:
+  std::unordered_map<std::type_index, slack_t> by_type_{};
+};
+
+// Fills the result of size_histogram()
+class histogram_observer_t final : public observer_t {
+public:
+  explicit histogram_observer_t(size_histogram_t& o_histogram) : histogram_{ o_histogram } {}
+  auto block(const block_t& block) -> void override {
+    if (block.count == 0) {
+      histogram_.opaque_bytes += block.bytes;
+      return;
+    }
+    const auto block_size = block.bytes / block.count;
+    const auto& bounds = histogram_.upper_bounds;
+    const auto size_class = static_cast<size_t>(
+      std::lower_bound(bounds.begin(), bounds.end(), block_size) - bounds.begin()
+    );
+    histogram_.blocks[size_class] += block.count;
+    histogram_.bytes[size_class] += block.bytes;
+  }
+private:
+  size_histogram_t& histogram_;
+};
+
+// Keeps the n largest blocks of top_n() in a min-heap. The path is a stack of
+// segments, the path of each deferred pointee is saved until it is measured.
+class top_n_observer_t final : public observer_t {
+public:
+  explicit top_n_observer_t(size_t n) : n_{ n } {}
+  auto enter(const segment_t& segment) -> void override {
+    path_.push_back(segment);
+  }
+  auto leave() -> void override {
+    path_.pop_back();
+  }
+  auto block(const block_t& block) -> void override {
+    if (block.count == 0 || n_ == 0) {
+      return;
+    }
+    const auto block_size = block.bytes / block.count;
+    for (size_t i = 0; i < block.count && (heap_.size() < n_ || block_size > heap_.front().bytes); ++i) {
+      if (heap_.size() == n_) {
+        std::pop_heap(heap_.begin(), heap_.end(), is_heavier);
+        heap_.pop_back();
+      }
+      heap_.push_back(heavy_block_t{ block_size, path_string(), std::type_index{ *block.type } });
+      std::push_heap(heap_.begin(), heap_.end(), is_heavier);
+    }
+  }
+  [[nodiscard]] auto position() -> size_t override {
+    if (free_slots_.empty()) {
+      saved_paths_.emplace_back();
+      free_slots_.push_back(saved_paths_.size() - 1);
+    }
+    const auto slot = free_slots_.back();
+    free_slots_.pop_back();
+    saved_paths_[slot] = path_;
+    return slot;
+  }
+  auto restore(size_t position) -> void override {
+    std::swap(path_, saved_paths_[position]);
+    free_slots_.push_back(position);
+  }
+  [[nodiscard]] auto result() -> std::vector<heavy_block_t> {
+    std::sort_heap(heap_.begin(), heap_.end(), is_heavier);
+    return std::move(heap_);
+  }
+private:
+  [[nodiscard]] static auto is_heavier(const heavy_block_t& a, const heavy_block_t& b) -> bool {
+    return a.bytes > b.bytes;
+  }
+  [[nodiscard]] auto path_string() const -> std::string {
+    auto path = std::string{};
+    for (const auto& segment : path_) {
+      if (segment.kind == esegment::Element) {
+        path += "[" + std::to_string(segment.index) + "]";
+        continue;
+      }
+      if (!path.empty()) {
+        path += ".";
+      }
+      if (segment.name.empty()) {
+        path += std::to_string(segment.index);
+      }
+      else {
+        path += segment.name;
+      }
+    }
+    return path;
+  }
+  const size_t n_{};
+  std::vector<segment_t> path_{};
+  std::vector<heavy_block_t> heap_{};
+  std::vector<std::vector<segment_t>> saved_paths_{};
+  std::vector<size_t> free_slots_{};
+};
+
+// Writers of write_folded_stacks() and write_pprof() take a path at a time,
+// frames holds the names from the root to the path
+class folded_stacks_sink_t {
+public:
+  explicit folded_stacks_sink_t(std::ostream& os) : os_{ os } {}
+  auto write(
+    const std::vector<std::string_view>& frames,
+    size_t bytes,
+    [[maybe_unused]] size_t heap_blocks
+  ) -> void {
+    if (bytes == 0) {
+      return;
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+      if (i > 0) {
+        os_ << ';';
+      }
+      os_ << frames[i];
+    }
+    os_ << ' ' << bytes << '\n';
+  }
+private:
+  std::ostream& os_;
+};
+
+
+// Protocol buffers wire format, enough to write a pprof profile
+namespace protobuf {
+inline auto append_varint(std::string& io_buffer, uint64_t value) -> void {
+  while (value >= 0x80) {
+    io_buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  io_buffer.push_back(static_cast<char>(value));
+}
+inline auto append_varint_field(std::string& io_buffer, uint32_t field, uint64_t value) -> void {
+  append_varint(io_buffer, uint64_t{ field } << 3);
+  append_varint(io_buffer, value);
+}
+inline auto append_bytes_field(std::string& io_buffer, uint32_t field, std::string_view bytes) -> void {
+  append_varint(io_buffer, (uint64_t{ field } << 3) | 2);
+  append_varint(io_buffer, bytes.size());
+  io_buffer.append(bytes.data(), bytes.size());
+}
+}
+
+// Field numbers of perftools.profiles.Profile, see pprof's profile.proto
+namespace pprof {
+inline constexpr auto profile_sample_type = uint32_t{ 1 };
+inline constexpr auto profile_sample = uint32_t{ 2 };
+inline constexpr auto profile_location = uint32_t{ 4 };
+inline constexpr auto profile_function = uint32_t{ 5 };
+inline constexpr auto profile_string_table = uint32_t{ 6 };
+inline constexpr auto profile_default_sample_type = uint32_t{ 14 };
+inline constexpr auto value_type_type = uint32_t{ 1 };
+inline constexpr auto value_type_unit = uint32_t{ 2 };
+inline constexpr auto sample_location_id = uint32_t{ 1 };
+inline constexpr auto sample_value = uint32_t{ 2 };
+inline constexpr auto location_id = uint32_t{ 1 };
+inline constexpr auto location_line = uint32_t{ 4 };
+inline constexpr auto line_function_id = uint32_t{ 1 };
+inline constexpr auto function_id = uint32_t{ 1 };
+inline constexpr auto function_name = uint32_t{ 2 };
+// Indices of the string table entries written before the names of the nodes
+inline constexpr auto string_inuse_objects = uint64_t{ 1 };
+inline constexpr auto string_count = uint64_t{ 2 };
+inline constexpr auto string_inuse_space = uint64_t{ 3 };
+inline constexpr auto string_bytes = uint64_t{ 4 };
+inline constexpr auto fixed_string_count = uint64_t{ 5 };
+
+// Every distinct name gets a string, a function and a location with the same
+// id, the string table index of a name is fixed_string_count + id - 1
+class sink_t {
+public:
+  explicit sink_t(std::ostream& os) : os_{ os } {
+    auto value_type_f = [this](uint64_t type, uint64_t unit) -> void {
+      field_.clear();
+      protobuf::append_varint_field(field_, value_type_type, type);
+      protobuf::append_varint_field(field_, value_type_unit, unit);
+      protobuf::append_bytes_field(message_, profile_sample_type, field_);
+    };
+    value_type_f(string_inuse_objects, string_count);
+    value_type_f(string_inuse_space, string_bytes);
+    protobuf::append_varint_field(message_, profile_default_sample_type, string_inuse_space);
+    for (const auto string : { "", "inuse_objects", "count", "inuse_space", "bytes" }) {
+      protobuf::append_bytes_field(message_, profile_string_table, string);
+    }
+    flush();
+  }
+  auto write(
+    const std::vector<std::string_view>& frames,
+    size_t bytes,
+    size_t heap_blocks
+  ) -> void {
+    if (bytes == 0 && heap_blocks == 0) {
+      return;
+    }
+    // Names are numbered from the root, the first location of a sample is
+    // the leaf
+    stack_.clear();
+    for (const auto frame : frames) {
+      stack_.push_back(id(frame));
+    }
+    auto& packed = packed_;
+    packed.clear();
+    for (auto it = stack_.rbegin(); it != stack_.rend(); ++it) {
+      protobuf::append_varint(packed, *it);
+    }
+    field_.clear();
+    protobuf::append_bytes_field(field_, sample_location_id, packed);
+    packed.clear();
+    protobuf::append_varint(packed, heap_blocks);
+    protobuf::append_varint(packed, bytes);
+    protobuf::append_bytes_field(field_, sample_value, packed);
+    protobuf::append_bytes_field(message_, profile_sample, field_);
+    flush();
+  }
+private:
+  [[nodiscard]] auto id(std::string_view name) -> uint64_t {
+    const auto [it, is_new] = ids_.try_emplace(std::string{ name }, ids_.size() + 1);
+    const auto id = it->second;
+    if (is_new) {
+      protobuf::append_bytes_field(message_, profile_string_table, name);
+      field_.clear();
+      protobuf::append_varint_field(field_, function_id, id);
+      protobuf::append_varint_field(field_, function_name, fixed_string_count + id - 1);
+      protobuf::append_bytes_field(message_, profile_function, field_);
+      auto line = std::string{};
+      protobuf::append_varint_field(line, line_function_id, id);
+      field_.clear();
+      protobuf::append_varint_field(field_, location_id, id);
+      protobuf::append_bytes_field(field_, location_line, line);
+      protobuf::append_bytes_field(message_, profile_location, field_);
+    }
+    return id;
+  }
+  auto flush() -> void {
+    os_.write(message_.data(), static_cast<std::streamsize>(message_.size()));
+    message_.clear();
+  }
+  std::ostream& os_;
+  std::unordered_map<std::string, uint64_t> ids_{};
+  std::string message_{};
+  std::string field_{};
+  std::string packed_{};
+  std::vector<uint64_t> stack_{};
+};
+}
+
+// Writes every node of a breakdown to a sink, walking with an explicit stack
+template <typename Sink>
+auto write_tree(
+  Sink& io_sink,
+  const breakdown_node_t& root,
+  std::string_view root_name
+) -> void {
+  struct entry_t {
+    const breakdown_node_t* node{};
+    size_t depth{};
+  };
+  auto frames = std::vector<std::string_view>{};
+  auto stack = std::vector<entry_t>{ entry_t{ std::addressof(root), 0 } };
+  while (!stack.empty()) {
+    const auto entry = stack.back();
+    stack.pop_back();
+    frames.resize(entry.depth);
+    frames.push_back(entry.depth == 0 ? root_name : std::string_view{ entry.node->name });
+    io_sink.write(frames, entry.node->exclusive_bytes, entry.node->heap_blocks);
+    const auto& children = entry.node->children;
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      stack.push_back(entry_t{ std::addressof(*it), entry.depth + 1 });
+    }
+  }
+}
+
+// Writes the paths to a sink during the traversal. The current path is kept
+// as a stack of levels, a level entered with the segment and type of an
+// ancestor is folded into it as in breakdown_observer_t. The bytes of a
+// level are written when it is left, consecutive writes of the same path are
+// merged. Deferred pointees restore the path folded up to them.
+template <typename Sink>
+class path_writer_observer_t final : public observer_t {
+public:
+  path_writer_observer_t(Sink& io_sink, std::string_view root_name) : sink_{ io_sink } {
+    levels_.push_back(level_t{ segment_t{}, std::string{ root_name } });
+  }
+  auto enter(const segment_t& segment) -> void override {
+    auto level = level_t{ segment, name(segment) };
+    level.parent = current_;
+    level.previous = current_;
+    levels_.push_back(std::move(level));
+    current_ = levels_.size() - 1;
+    is_entered_ = true;
+  }
+  auto leave() -> void override {
+    write_level(levels_.size() - 1);
+    current_ = levels_.back().previous;
+    levels_.pop_back();
+    is_entered_ = false;
+  }
+  auto object(const std::type_info& type) -> void override {
+    auto& level = levels_[current_];
+    if (level.type == nullptr) {
+      level.type = std::addressof(type);
+    }
+    if (!is_entered_) {
+      return;
+    }
+    is_entered_ = false;
+    for (auto ancestor = level.parent; ancestor != 0 && ancestor != no_level; ancestor = levels_[ancestor].parent) {
+      const auto& candidate = levels_[ancestor];
+      if (candidate.type != nullptr && *candidate.type == type && is_same_segment(candidate.segment, level.segment)) {
+        current_ = ancestor;
+        return;
+      }
+    }
+  }
+  auto block(const block_t& block) -> void override {
+    levels_[current_].bytes += block.bytes;
+    levels_[current_].heap_blocks += block.count;
+  }
+  // Saves the levels from the root to the current one, without the folded
+  // levels in between
+  [[nodiscard]] auto position() -> size_t override {
+    if (free_slots_.empty()) {
+      saved_paths_.emplace_back();
+      free_slots_.push_back(saved_paths_.size() - 1);
+    }
+    const auto slot = free_slots_.back();
+    free_slots_.pop_back();
+    auto& saved = saved_paths_[slot];
+    saved.clear();
+    for (auto idx = current_; idx != no_level; idx = levels_[idx].parent) {
+      saved.push_back(levels_[idx]);
+    }
+    std::reverse(saved.begin(), saved.end());
+    for (size_t i = 0; i < saved.size(); ++i) {
+      saved[i].parent = i == 0 ? no_level : i - 1;
+      saved[i].previous = saved[i].parent;
+      saved[i].bytes = 0;
+      saved[i].heap_blocks = 0;
+    }
+    return slot;
+  }
+  auto restore(size_t position) -> void override {
+    write_levels();
+    std::swap(levels_, saved_paths_[position]);
+    free_slots_.push_back(position);
+    current_ = levels_.size() - 1;
+    is_entered_ = false;
+  }
+  // Writes the bytes not yet written once the traversal is done
+  auto finish() -> void {
+    write_levels();
+    flush();
+  }
+private:
+  static constexpr auto no_level = std::numeric_limits<size_t>::max();
+  struct level_t {
+    segment_t segment{};
+    std::string name{};
+    const std::type_info* type{nullptr};
+    // Level this one is a child of, after folding
+    size_t parent{no_level};
+    // Level to return to on leave()
+    size_t previous{no_level};
+    size_t bytes{};
+    size_t heap_blocks{};
+  };
+  [[nodiscard]] static auto name(const segment_t& segment) -> std::string {
+    return
+      segment.kind == esegment::Element ? std::string{ "[*]" } :
+      !segment.name.empty() ? std::string{ segment.name } :
+      std::to_string(segment.index);
+  }
+  [[nodiscard]] static auto is_same_segment(const segment_t& a, const segment_t& b) -> bool {
+    return
+      a.kind == b.kind && (
+        a.kind == esegment::Element || (
+          a.index == b.index &&
+          a.name == b.name
+        )
+      );
+  }
+  auto write_level(size_t idx) -> void {
+    auto& level = levels_[idx];
+    if (level.bytes == 0 && level.heap_blocks == 0) {
+      return;
+    }
+    frames_.clear();
+    for (auto frame = idx; frame != no_level; frame = levels_[frame].parent) {
+      frames_.push_back(levels_[frame].name);
+    }
+    std::reverse(frames_.begin(), frames_.end());
+    const auto is_pending_path =
+      frames_.size() == pending_frames_.size() &&
+      std::equal(frames_.begin(), frames_.end(), pending_frames_.begin());
+    if (!is_pending_path) {
+      flush();
+      pending_frames_.assign(frames_.begin(), frames_.end());
+    }
+    pending_bytes_ += level.bytes;
+    pending_heap_blocks_ += level.heap_blocks;
+    level.bytes = 0;
+    level.heap_blocks = 0;
+  }
+  auto write_levels() -> void {
+    for (auto idx = levels_.size(); idx-- > 0;) {
+      write_level(idx);
+    }
+  }
+  auto flush() -> void {
+    if (pending_bytes_ == 0 && pending_heap_blocks_ == 0) {
+      return;
+    }
+    pending_views_.assign(pending_frames_.begin(), pending_frames_.end());
+    sink_.write(pending_views_, pending_bytes_, pending_heap_blocks_);
+    pending_bytes_ = 0;
+    pending_heap_blocks_ = 0;
+  }
+  Sink& sink_;
+  std::vector<level_t> levels_{};
+  size_t current_{0};
+  bool is_entered_{false};
+  std::vector<std::vector<level_t>> saved_paths_{};
+  std::vector<size_t> free_slots_{};
+  std::vector<std::string_view> frames_{};
+  std::vector<std::string> pending_frames_{};
+  std::vector<std::string_view> pending_views_{};
+  size_t pending_bytes_{};
+  size_t pending_heap_blocks_{};
+};
+
+// Forwards the hooks provided by the visitor of visit()
+template <typename Visitor>
+class visitor_observer_t final : public observer_t {
+public:
+  explicit visitor_observer_t(Visitor& visitor) : visitor_{ visitor } {}
+  auto enter(const segment_t& segment) -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::enter_hook_t>::value) {
+      visitor_.enter(segment);
+    }
+  }
+  auto leave() -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::leave_hook_t>::value) {
+      visitor_.leave();
+    }
+  }
+  auto object(const std::type_info& type) -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::object_hook_t>::value) {
+      visitor_.object(type);
+    }
+  }
+  auto block(const block_t& block) -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::block_hook_t>::value) {
+      visitor_.block(block);
+    }
+  }
+  auto pointer(const void* pointee, const std::type_info& type, bool is_first_visit) -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::pointer_hook_t>::value) {
+      visitor_.pointer(pointee, type, is_first_visit);
+    }
+  }
+  auto unknown_type(const std::type_info& type) -> void override {
+    if constexpr (type_traits::introspection::detect<Visitor, type_traits::unknown_type_hook_t>::value) {
+      visitor_.unknown_type(type);
+    }
+  }
+  [[nodiscard]] auto position() -> size_t override {
+    if constexpr (type_traits::has_path_hooks_v<Visitor>) {
+      return visitor_.position();
+    }
+    else {
+      return 0;
+    }
+  }
+  auto restore([[maybe_unused]] size_t position) -> void override {
+    if constexpr (type_traits::has_path_hooks_v<Visitor>) {
+      visitor_.restore(position);
+    }
+  }
+private:
+  Visitor& visitor_;
+};
+
+// Walks the tree with an explicit stack, the path of a node is appended to
+// the path of its parent in a single buffer
+template <typename F>
+auto for_each_path(
+  const breakdown_node_t& root,
+  F& f
+) -> void {
+  struct entry_t {
+    const breakdown_node_t* node{};
+    // Size of the path of the parent
+    size_t path_size{};
+  };
+  auto path = std::string{};
+  auto stack = std::vector<entry_t>{ entry_t{ std::addressof(root), 0 } };
+  while (!stack.empty()) {
+    const auto entry = stack.back();
+    stack.pop_back();
+    path.resize(entry.path_size);
+    if (entry.node != std::addressof(root)) {
+      if (!path.empty() && entry.node->name != "[*]") {
+        path += '.';
+      }
+      path += entry.node->name;
+    }
+    f(std::as_const(path), *entry.node);
+    const auto& children = entry.node->children;
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      stack.push_back(entry_t{ std::addressof(*it), path.size() });
+    }
+  }
+}
+}
+
+template <typename AnyTypeList, typename T>
+auto measure(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options
+) -> report_t {
+  auto report = detail::measure_in_context<AnyTypeList>(context, value, options);
+  // Swapped rather than copied, the report gets the set of the context and
+  // the context an empty set which allocates nothing until used
+  std::swap(report.unknown_types, context.unknown_types);
+  return report;
+}
+
+template <typename AnyTypeList, typename T>
+auto measure(
+  const T& value,
+  const options_t& options
+) -> report_t {
+  auto context = measurement_context_t{};
+  auto report = detail::measure_in_context<AnyTypeList>(context, value, options);
+  report.unknown_types = std::move(context.unknown_types);
+  return report;
+}
+
+template <typename AnyTypeList, typename T>
+auto weight_in_bytes(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options
+) -> size_t {
+  return detail::measure_in_context<AnyTypeList>(context, value, options).bytes;
+}
+
+template <typename AnyTypeList, typename T>
+auto weight_in_bytes(
+  const T& value,
+  const options_t& options
+) -> size_t {
+  auto context = measurement_context_t{};
+  return weight_in_bytes<AnyTypeList>(context, value, options);
+}
+
 template <typename AnyTypeList, typename T>
 auto weight_in_bytes(
   const T& value,
   const efollow_raw_pointers follow_raw_pointers
 ) -> size_t {
+  return weight_in_bytes<AnyTypeList>(value, options_t{ follow_raw_pointers });
+}
+
+template <typename AnyTypeList, typename T>
+auto unknown_types(
+  measurement_context_t& context,
+  const T& value,
+  const options_t& options
+) -> const typeindex_set_t& {
+  [[maybe_unused]] const auto bytes = weight_in_bytes<AnyTypeList>(context, value, options);
+  return context.unknown_types;
+}
+
+template <typename AnyTypeList, typename T>
+auto exceeds(
+  const T& value,
+  const size_t limit,
+  const options_t& options
+) -> bool {
+  auto limited_options = options;
+  limited_options.byte_limit = limit;
+  auto context = measurement_context_t{};
+  return detail::measure_in_context<AnyTypeList>(context, value, limited_options).limit_exceeded;
+}
+
+template <typename AnyTypeList, typename T>
+auto weight_at_most(
+  const T& value,
+  const size_t limit,
+  const options_t& options
+) -> std::optional<size_t> {
+  auto limited_options = options;
+  limited_options.byte_limit = limit;
+  auto context = measurement_context_t{};
+  const auto report = detail::measure_in_context<AnyTypeList>(context, value, limited_options);
+  if (report.limit_exceeded) {
+    return std::nullopt;
+  }
+  return report.bytes;
+}
+
+template <typename AnyTypeList, typename T>
+auto measure_until(
+  const T& value,
+  const std::chrono::steady_clock::time_point deadline,
+  const options_t& options
+) -> report_t {
+  auto limited_options = options;
+  limited_options.deadline = deadline;
+  return measure<AnyTypeList>(value, limited_options);
+}
+
+template <typename AnyTypeList, typename T>
+auto breakdown(
+  const T& value,
+  const options_t& options
+) -> breakdown_node_t {
   static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto context = measurement_context_t{};
+  auto observer = detail::breakdown_observer_t{};
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  return observer.tree();
+}
+
+template <typename AnyTypeList, typename T>
+auto weight_by_type(
+  const T& value,
+  const options_t& options
+) -> type_weights_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto weights = type_weights_t{};
+  auto context = measurement_context_t{};
+  auto observer = detail::type_observer_t{ weights };
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  return weights;
+}
+
+template <typename F>
+auto for_each_path(
+  const breakdown_node_t& root,
+  F&& f
+) -> void {
+  detail::for_each_path(root, f);
+}
+
+template <typename AnyTypeList, typename T>
+auto slack_report(
+  const T& value,
+  const options_t& options
+) -> slack_report_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto context = measurement_context_t{};
+  auto observer = detail::slack_observer_t{};
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  auto report = slack_report_t{};
+  report.by_type = std::move(observer.by_type());
+  for_each_path(observer.tree(), [&report](const std::string& path, const breakdown_node_t& node) {
+    if (node.slack.containers > 0) {
+      report.used_bytes += node.slack.used_bytes;
+      report.slack_bytes += node.slack.slack_bytes;
+      report.rounding_bytes += node.slack.rounding_bytes;
+      report.by_path.emplace(path, node.slack);
+    }
+  });
+  return report;
+}
+
+template <typename AnyTypeList, typename T>
+auto shrink_to_fit_all(
+  T& value,
+  const size_t min_slack_bytes
+) -> size_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  static_assert(!std::is_const_v<T>, "shrink_to_fit_all() requires a mutable value");
   auto handled_addresses = detail::address_set_t{};
+  auto io_data = detail::shrink_data_t{ min_slack_bytes, handled_addresses };
+  return detail::shrink_heap_allocations<AnyTypeList>(value, io_data);
+}
+
+template <typename AnyTypeList, typename T>
+auto size_histogram(
+  const T& value,
+  const std::vector<size_t>& size_classes,
+  const options_t& options
+) -> size_histogram_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto histogram = size_histogram_t{};
+  if (size_classes.empty()) {
+    for (auto bound = size_t{ 1 }; bound != 0; bound <<= 1) {
+      histogram.upper_bounds.push_back(bound);
+    }
+  }
+  else {
+    histogram.upper_bounds = size_classes;
+  }
+  if (histogram.upper_bounds.back() != std::numeric_limits<size_t>::max()) {
+    histogram.upper_bounds.push_back(std::numeric_limits<size_t>::max());
+  }
+  histogram.blocks.resize(histogram.upper_bounds.size());
+  histogram.bytes.resize(histogram.upper_bounds.size());
+  auto context = measurement_context_t{};
+  auto observer = detail::histogram_observer_t{ histogram };
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  return histogram;
+}
+
+template <typename AnyTypeList, typename T>
+auto top_n(
+  const T& value,
+  const size_t n,
+  const options_t& options
+) -> std::vector<heavy_block_t> {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto context = measurement_context_t{};
+  auto observer = detail::top_n_observer_t{ n };
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  return observer.result();
+}
+
+inline auto write_folded_stacks(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  const std::string_view root_name
+) -> void {
+  auto sink = detail::folded_stacks_sink_t{ os };
+  detail::write_tree(sink, root, root_name);
+}
+
+inline auto write_pprof(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  const std::string_view root_name
+) -> void {
+  auto sink = detail::pprof::sink_t{ os };
+  detail::write_tree(sink, root, root_name);
+}
+
+namespace detail {
+template <typename AnyTypeList, typename Sink, typename T>
+auto write_paths(
+  Sink& io_sink,
+  const T& value,
+  const std::string_view root_name,
+  const options_t& options
+) -> void {
+  static_assert(type_traits::is_tuple_v<AnyTypeList>);
+  auto context = measurement_context_t{};
+  auto observer = path_writer_observer_t<Sink>{ io_sink, root_name };
+  auto current_depth = size_t{ 0 };
+  auto io_data = make_data(context, options, current_depth);
+  io_data.observer = std::addressof(observer);
+  [[maybe_unused]] const auto bytes = traverse<AnyTypeList>(value, io_data);
+  observer.finish();
+}
+}
+
+template <typename AnyTypeList, typename T>
+auto write_folded_stacks(
+  std::ostream& os,
+  const T& value,
+  const std::string_view root_name,
+  const options_t& options
+) -> std::enable_if_t<!std::is_same_v<T, breakdown_node_t>> {
+  auto sink = detail::folded_stacks_sink_t{ os };
+  detail::write_paths<AnyTypeList>(sink, value, root_name, options);
+}
+
+template <typename AnyTypeList, typename T>
+auto write_pprof(
+  std::ostream& os,
+  const T& value,
+  const std::string_view root_name,
+  const options_t& options
+) -> std::enable_if_t<!std::is_same_v<T, breakdown_node_t>> {
+  auto sink = detail::pprof::sink_t{ os };
+  detail::write_paths<AnyTypeList>(sink, value, root_name, options);
+}
+
+namespace detail {
+[[nodiscard]] inline auto fnv1a(std::string_view name) noexcept -> uint64_t {
+  auto hash = uint64_t{ 0xcbf29ce484222325ull };
+  for (const auto c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+[[nodiscard]] inline auto is_ordered_before(
+  const snapshot_record_t& a,
+  std::string_view a_name,
+  const snapshot_record_t& b,
+  std::string_view b_name
+) noexcept -> bool {
+  return a.hash != b.hash ? a.hash < b.hash : a_name < b_name;
+}
+}
+
+inline auto snapshot_view_t::from_bytes(
+  const void* data,
+  const size_t size
+) -> std::optional<snapshot_view_t> {
+  constexpr auto alignment = alignof(snapshot_record_t);
+  const auto* bytes = static_cast<const char*>(data);
+  if (
+    data == nullptr ||
+    reinterpret_cast<uintptr_t>(data) % alignment != 0 ||
+    size < sizeof(snapshot_header_t)
+  ) {
+    return std::nullopt;
+  }
+  const auto& header = *static_cast<const snapshot_header_t*>(data);
+  const auto expected = snapshot_header_t{};
+  if (
+    header.magic != expected.magic ||
+    header.version != expected.version ||
+    header.byte_order != expected.byte_order
+  ) {
+    return std::nullopt;
+  }
+  // The counts are checked one at a time as their sum may overflow
+  const auto max_records = size / sizeof(snapshot_record_t);
+  if (header.path_count > max_records || header.type_count > max_records - header.path_count) {
+    return std::nullopt;
+  }
+  const auto record_count = header.path_count + header.type_count;
+  if (
+    header.records_offset % alignment != 0 ||
+    header.records_offset > size ||
+    record_count * sizeof(snapshot_record_t) > size - header.records_offset ||
+    header.names_offset > size ||
+    header.names_size > size - header.names_offset
+  ) {
+    return std::nullopt;
+  }
+  // The names may not overlap the records
+  const auto records_end = header.records_offset + record_count * sizeof(snapshot_record_t);
+  if (header.names_offset < records_end && header.records_offset < header.names_offset + header.names_size) {
+    return std::nullopt;
+  }
+  const auto* records = reinterpret_cast<const snapshot_record_t*>(bytes + header.records_offset);
+  auto view = snapshot_view_t{};
+  view.paths_ = snapshot_records_t{ records, records + header.path_count };
+  view.types_ = snapshot_records_t{ records + header.path_count, records + record_count };
+  view.names_ = std::string_view{ bytes + header.names_offset, static_cast<size_t>(header.names_size) };
+  return view;
+}
+
+inline auto snapshot_view_t::name(
+  const snapshot_record_t& record
+) const noexcept -> std::string_view {
+  if (record.name_offset > names_.size() || record.name_size > names_.size() - record.name_offset) {
+    return {};
+  }
+  return names_.substr(static_cast<size_t>(record.name_offset), static_cast<size_t>(record.name_size));
+}
+
+inline auto write_snapshot(
+  std::ostream& os,
+  const breakdown_node_t& root,
+  const type_weights_t& type_weights
+) -> void {
+  auto names = std::string{};
+  auto add_record_f = [&names](std::vector<snapshot_record_t>& o_records, std::string_view name) -> snapshot_record_t& {
+    auto& record = o_records.emplace_back();
+    record.hash = detail::fnv1a(name);
+    record.name_offset = names.size();
+    record.name_size = name.size();
+    names.append(name.data(), name.size());
+    return record;
+  };
+  auto paths = std::vector<snapshot_record_t>{};
+  for_each_path(root, [&paths, &add_record_f](const std::string& path, const breakdown_node_t& node) {
+    auto& record = add_record_f(paths, path);
+    record.bytes = node.exclusive_bytes;
+    record.inclusive_bytes = node.inclusive_bytes;
+    record.count = node.count;
+    record.heap_blocks = node.heap_blocks;
+  });
+  auto types = std::vector<snapshot_record_t>{};
+  for (const auto& [type, weight] : type_weights) {
+    auto& record = add_record_f(types, type.name());
+    record.bytes = weight.bytes;
+    record.inclusive_bytes = weight.bytes;
+    record.count = weight.instances;
+    record.heap_blocks = weight.heap_blocks;
+  }
+  auto sort_f = [&names](std::vector<snapshot_record_t>& io_records) -> void {
+    auto name_f = [&names](const snapshot_record_t& record) {
+      return std::string_view{ names }.substr(record.name_offset, record.name_size);
+    };
+    std::sort(io_records.begin(), io_records.end(), [&name_f](const auto& a, const auto& b) {
+      return detail::is_ordered_before(a, name_f(a), b, name_f(b));
+    });
+  };
+  sort_f(paths);
+  sort_f(types);
+
+  auto header = snapshot_header_t{};
+  header.path_count = paths.size();
+  header.type_count = types.size();
+  header.records_offset = sizeof(snapshot_header_t);
+  header.names_offset = header.records_offset + (paths.size() + types.size()) * sizeof(snapshot_record_t);
+  header.names_size = names.size();
+  auto write_f = [&os](const void* data, size_t size) -> void {
+    os.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+  };
+  write_f(std::addressof(header), sizeof(header));
+  write_f(paths.data(), paths.size() * sizeof(snapshot_record_t));
+  write_f(types.data(), types.size() * sizeof(snapshot_record_t));
+  write_f(names.data(), names.size());
+}
+
+inline auto diff_snapshots(
+  const snapshot_records_t before,
+  const snapshot_view_t& before_view,
+  const snapshot_records_t after,
+  const snapshot_view_t& after_view,
+  const size_t n
+) -> std::vector<snapshot_delta_t> {
+  auto magnitude_f = [](const snapshot_delta_t& delta) -> uint64_t {
+    return delta.bytes_after > delta.bytes_before ?
+      delta.bytes_after - delta.bytes_before :
+      delta.bytes_before - delta.bytes_after;
+  };
+  // Min-heap of the n largest changes
+  auto is_larger_f = [&magnitude_f](const snapshot_delta_t& a, const snapshot_delta_t& b) -> bool {
+    return magnitude_f(a) > magnitude_f(b);
+  };
+  auto heap = std::vector<snapshot_delta_t>{};
+  auto add_f = [&heap, &is_larger_f, &magnitude_f, n](const snapshot_delta_t& delta) -> void {
+    if (n == 0 || magnitude_f(delta) == 0) {
+      return;
+    }
+    if (heap.size() == n) {
+      if (!is_larger_f(delta, heap.front())) {
+        return;
+      }
+      std::pop_heap(heap.begin(), heap.end(), is_larger_f);
+      heap.pop_back();
+    }
+    heap.push_back(delta);
+    std::push_heap(heap.begin(), heap.end(), is_larger_f);
+  };
+  // Merge join of the sorted records
+  auto it_before = before.begin();
+  auto it_after = after.begin();
+  while (it_before != before.end() || it_after != after.end()) {
+    auto delta = snapshot_delta_t{};
+    const auto name_before = it_before != before.end() ? before_view.name(*it_before) : std::string_view{};
+    const auto name_after = it_after != after.end() ? after_view.name(*it_after) : std::string_view{};
+    const auto take_before =
+      it_after == after.end() ||
+      (it_before != before.end() && !detail::is_ordered_before(*it_after, name_after, *it_before, name_before));
+    const auto take_after =
+      it_before == before.end() ||
+      (it_after != after.end() && !detail::is_ordered_before(*it_before, name_before, *it_after, name_after));
+    if (take_before) {
+      delta.name = name_before;
+      delta.bytes_before = it_before->bytes;
+      delta.count_before = it_before->count;
+      ++it_before;
+    }
+    if (take_after) {
+      delta.name = name_after;
+      delta.bytes_after = it_after->bytes;
+      delta.count_after = it_after->count;
+      ++it_after;
+    }
+    add_f(delta);
+  }
+  std::sort_heap(heap.begin(), heap.end(), is_larger_f);
+  return heap;
+}
+
+template <typename AnyTypeList, typename T, typename Visitor>
+auto visit(
+  const T& value,
+  Visitor& visitor,
+  const options_t& options
+) -> report_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto visit_options = options;
+  if constexpr (!detail::type_traits::has_path_hooks_v<Visitor>) {
+    visit_options.traversal = etraversal::Recursive;
+  }
+  auto context = measurement_context_t{};
+  auto observer = detail::visitor_observer_t<Visitor>{ visitor };
   auto current_depth = size_t{ 0 };
-  auto io_data = detail::data_t{
-    follow_raw_pointers,
-    handled_addresses,
-    nullptr,
-    current_depth
+  auto io_data = detail::make_data(context, visit_options, current_depth);
+  io_data.observer = std::addressof(observer);
+  const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+  auto report = detail::make_report(bytes, io_data);
+  report.unknown_types = std::move(context.unknown_types);
+  return report;
+}
+
+namespace detail {
+[[nodiscard]] constexpr auto round_up(size_t bytes, size_t alignment) noexcept -> size_t {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+inline constexpr auto tcmalloc_size_classes = std::array<uint32_t, 86>{ {
+  8, 16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+  272, 288, 304, 320, 336, 352, 368, 384, 400, 416, 448, 480, 512, 576, 640,
+  704, 768, 896, 1024, 1152, 1280, 1408, 1536, 1792, 2048, 2304, 2560, 2688,
+  2816, 3200, 3456, 3584, 4096, 4736, 5120, 5376, 6144, 6528, 7168, 8192,
+  9472, 10240, 12288, 13568, 14336, 16384, 20480, 24576, 28672, 32768, 40960,
+  49152, 57344, 65536, 73728, 81920, 90112, 98304, 106496, 114688, 131072,
+  139264, 155648, 172032, 188416, 204800, 229376, 245760, 262144
+} };
+}
+
+inline auto glibc_allocator_model(const size_t requested_bytes) noexcept -> size_t {
+  constexpr auto size_header = size_t{ 8 };
+  constexpr auto alignment = size_t{ 16 };
+  constexpr auto min_chunk = size_t{ 32 };
+  constexpr auto mmap_threshold = size_t{ 128 * 1024 };
+  constexpr auto page_size = size_t{ 4096 };
+  if (requested_bytes >= mmap_threshold) {
+    return detail::round_up(requested_bytes + 2 * size_header, page_size);
+  }
+  return std::max(min_chunk, detail::round_up(requested_bytes + size_header, alignment));
+}
+
+inline auto jemalloc_allocator_model(const size_t requested_bytes) noexcept -> size_t {
+  if (requested_bytes <= 8) {
+    return 8;
+  }
+  if (requested_bytes <= 128) {
+    return detail::round_up(requested_bytes, 16);
+  }
+  // Four classes between each power of two, 2^lg < requested_bytes <= 2^(lg + 1)
+  auto lg = size_t{ 0 };
+  for (auto bits = requested_bytes - 1; bits > 1; bits >>= 1) {
+    ++lg;
+  }
+  return detail::round_up(requested_bytes, size_t{ 1 } << (lg - 2));
+}
+
+inline auto tcmalloc_allocator_model(const size_t requested_bytes) noexcept -> size_t {
+  const auto& classes = detail::tcmalloc_size_classes;
+  if (requested_bytes > classes.back()) {
+    return detail::round_up(requested_bytes, 8192);
+  }
+  return *std::lower_bound(classes.begin(), classes.end(), requested_bytes);
+}
+
+template <typename AnyTypeList, typename T>
+auto estimate_weight(
+  const T& value,
+  const sample_options_t& sample_options,
+  const options_t& options
+) -> estimate_t {
+  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+  auto context = measurement_context_t{};
+  auto sampling = detail::sampling_t{
+    sample_options.sample_size,
+    sample_options.method,
+    sample_options.prefix_factor,
+    std::mt19937_64{ sample_options.seed }
   };
-  return detail::get_heap_allocated_bytes<AnyTypeList>(value, io_data);
+  auto current_depth = size_t{ 0 };
+  auto io_data = detail::make_data(context, options, current_depth);
+  io_data.sampling = std::addressof(sampling);
+  auto estimate = estimate_t{};
+  estimate.bytes = static_cast<double>(detail::traverse<AnyTypeList>(value, io_data));
+  estimate.standard_error = std::sqrt(sampling.variance);
+  estimate.is_prefix_sampled = sampling.is_prefix_sampled;
+  // Two-sided z-score of the confidence level, erf(z / sqrt(2)) = confidence,
+  // solved with Newton's method
+  const auto confidence = std::clamp(sample_options.confidence, 0.0, 0.999999);
+  auto x = 0.0;
+  for (int i = 0; i < 64; ++i) {
+    const auto step = (std::erf(x) - confidence) / (1.1283791670955126 * std::exp(-x * x));
+    x -= step;
+    if (std::abs(step) < 1e-12) {
+      break;
+    }
+  }
+  const auto margin = std::sqrt(2.0) * x * estimate.standard_error;
+  estimate.lower_bound = std::max(0.0, estimate.bytes - margin);
+  estimate.upper_bound = estimate.bytes + margin;
+  return estimate;
 }
 
+#ifdef WIB_PARALLEL_ENABLED
+template <typename AnyTypeList, typename ExecutionPolicy, typename T>
+auto measure(
+  [[maybe_unused]] ExecutionPolicy&& policy,
+  const T& value,
+  const options_t& options
+) -> std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>, report_t> {
+  using policy_t = std::decay_t<ExecutionPolicy>;
+  constexpr auto is_parallel =
+    std::is_same_v<policy_t, std::execution::parallel_policy> ||
+    std::is_same_v<policy_t, std::execution::parallel_unsequenced_policy>;
+  if constexpr (!is_parallel) {
+    return measure<AnyTypeList>(value, options);
+  }
+  else {
+    static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
+    auto context = measurement_context_t{};
+    auto shared_addresses = detail::concurrent_address_set_t{};
+    const auto parallel = detail::parallel_t{
+      shared_addresses,
+      options.max_threads != 0 ? options.max_threads : std::max(size_t{ 1 }, size_t{ std::thread::hardware_concurrency() }),
+      options.min_elements_per_thread
+    };
+    auto current_depth = size_t{ 0 };
+    auto io_data = detail::make_data(context, options, current_depth);
+    io_data.parallel = std::addressof(parallel);
+    io_data.shared_addresses = std::addressof(shared_addresses);
+#ifdef WIB_STATS_ENABLED
+    const auto start_time = std::chrono::steady_clock::now();
+#endif
+    const auto bytes = detail::traverse<AnyTypeList>(value, io_data);
+#ifdef WIB_STATS_ENABLED
+    io_data.stats.wall_time = std::chrono::steady_clock::now() - start_time;
+#endif
+    auto report = detail::make_report(bytes, io_data);
+    report.unknown_types = std::move(context.unknown_types);
+    return report;
+  }
+}
+
+template <typename AnyTypeList, typename ExecutionPolicy, typename T>
+auto weight_in_bytes(
+  ExecutionPolicy&& policy,
+  const T& value,
+  const options_t& options
+) -> std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>, size_t> {
+  return measure<AnyTypeList>(std::forward<ExecutionPolicy>(policy), value, options).bytes;
+}
+#endif
+
 template <typename AnyTypeList, typename T>
 auto unknown_types(
   const T& value,
   const efollow_raw_pointers follow_raw_pointers
 ) -> typeindex_set_t {
-  static_assert(detail::type_traits::is_tuple_v<AnyTypeList>);
-  auto handled_addresses = detail::address_set_t{};
-  auto current_depth = size_t{ 0 };
-  auto unknown_types = typeindex_set_t{};
-  auto io_data = detail::data_t{
-    follow_raw_pointers,
-    handled_addresses,
-    std::addressof(unknown_types),
-    current_depth
-  };
-  [[maybe_unused]] const auto bytes = detail::get_heap_allocated_bytes<AnyTypeList>(
+  auto context = measurement_context_t{};
+  [[maybe_unused]] const auto bytes = weight_in_bytes<AnyTypeList>(
+    context,
     value,
-    io_data
+    options_t{ follow_raw_pointers }
   );
-  return unknown_types;
+  return std::move(context.unknown_types);
 }
 
 
@@ -612,4 +4251,3 @@ auto unknown_types(
 
 
 
-